@@ -0,0 +1,255 @@
+#include <linux/cpumask.h>
+#include <linux/kthread.h>
+#include <linux/module.h>
+#include <linux/sched/signal.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <net/sock.h>
+
+#include "acceptor.h"
+#include "ksocket_handler.h"
+#include "stats.h"
+
+// sized by acceptors_start for the mode, e.g. one per possible CPU
+static struct acceptor *acceptors;
+static int max_acceptors = 0;
+static int nr_acceptors = 0;
+static int (*acceptor_on_accept)(struct socket *sock);
+
+static int acceptor_daemon(void *data)
+{
+    struct acceptor *acc = data;
+    struct socket *sock;
+
+    allow_signal(SIGKILL);
+    allow_signal(SIGTERM);
+
+    while (!kthread_should_stop())
+    {
+        int error = kernel_accept(acc->sock, &sock, 0);
+        if (unlikely(error < 0))
+        {
+            if (READ_ONCE(acc->stopping))
+            {
+                // listener has been shut down, only wait for kthread_stop()
+                set_current_state(TASK_INTERRUPTIBLE);
+                if (!kthread_should_stop())
+                    schedule();
+                __set_current_state(TASK_RUNNING);
+                continue;
+            }
+            if (signal_pending(current))
+                flush_signals(current);
+            atomic64_inc(&acc->errors);
+            pr_err("%s: kernel_accept failed: %d\n", THIS_MODULE->name, error);
+            continue;
+        }
+
+        atomic64_inc(&acc->accepted);
+        if (unlikely(acceptor_on_accept(sock) < 0))
+        {
+            kernel_sock_shutdown(sock, SHUT_RDWR);
+            sock_release(sock);
+        }
+    }
+
+    return 0;
+}
+
+static int acceptor_add(struct socket *sock, int cpu, const char *ip, int port)
+{
+    struct acceptor *acc;
+
+    if (unlikely(nr_acceptors >= max_acceptors))
+    {
+        pr_err("%s: Too many acceptors (max %d)\n", THIS_MODULE->name, max_acceptors);
+        return -ENOSPC;
+    }
+
+    acc = &acceptors[nr_acceptors];
+    *acc = (struct acceptor){
+        .sock = sock,
+        .cpu = cpu,
+        .port = port,
+        .started = ktime_get(),
+    };
+    strscpy(acc->ip, ip, sizeof(acc->ip));
+
+    if (cpu >= 0)
+        acc->thread = kthread_create_on_cpu(acceptor_daemon, acc, cpu, "kserver_acc/%u");
+    else
+        acc->thread = kthread_create(acceptor_daemon, acc, "%s", THIS_MODULE->name);
+
+    if (unlikely(IS_ERR(acc->thread)))
+    {
+        int res = PTR_ERR(acc->thread);
+
+        pr_err("%s: Failed to create acceptor thread: %d\n", THIS_MODULE->name, res);
+        acc->thread = NULL;
+        return res;
+    }
+
+    nr_acceptors++;
+    wake_up_process(acc->thread);
+    return 0;
+}
+
+static int acceptors_open_single(int port, int cpu)
+{
+    struct socket *sock;
+    int res = open_lsocket(&sock, port);
+    if (unlikely(res < 0))
+        return res;
+
+    res = acceptor_add(sock, cpu, "0.0.0.0", port);
+    if (unlikely(res < 0))
+        close_lsocket(sock);
+    return res;
+}
+
+static int acceptors_open_per_cpu(int port)
+{
+    int cpu, res;
+
+    // every listener has SO_REUSEPORT (see open_lsocket) so the kernel
+    // hashes incoming connections over all of them
+    for_each_online_cpu(cpu)
+    {
+        res = acceptors_open_single(port, cpu);
+        if (unlikely(res < 0))
+            return res;
+    }
+    return 0;
+}
+
+static int acceptors_open_per_addr(const char *addresses)
+{
+    char *addresses_copy, *token, *ptr;
+    int res = 0, i = 0;
+
+    addresses_copy = kstrdup(addresses, GFP_KERNEL);
+    if (unlikely(!addresses_copy))
+        return -ENOMEM;
+
+    ptr = addresses_copy;
+    while ((token = strsep(&ptr, ",")))
+    {
+        struct socket *sock;
+        char ip[16];
+        int port;
+
+        while (*token == ' ' || *token == '\t')
+            token++;
+
+        res = ksocket_parse_address(token, ip, sizeof(ip), &port);
+        if (unlikely(res < 0))
+            break;
+
+        res = open_lsocket_addr(&sock, ip, port);
+        if (unlikely(res < 0))
+            break;
+
+        // spread the acceptors over the online CPUs
+        res = acceptor_add(sock, cpumask_nth(i++ % num_online_cpus(), cpu_online_mask), ip, port);
+        if (unlikely(res < 0))
+        {
+            close_lsocket(sock);
+            break;
+        }
+    }
+
+    kfree(addresses_copy);
+    return res;
+}
+
+static int acceptors_stats_show(struct seq_file *m, void *v)
+{
+    for (int i = 0; i < nr_acceptors; i++)
+    {
+        struct acceptor *acc = &acceptors[i];
+        s64 elapsed_ms = ktime_ms_delta(ktime_get(), acc->started);
+        u64 accepted = atomic64_read(&acc->accepted);
+
+        seq_printf(m, "acceptor[%d] %s:%d cpu=%d accepted=%llu errors=%llu rate=%llu/s\n", i, acc->ip, acc->port,
+                   acc->cpu, accepted, atomic64_read(&acc->errors),
+                   elapsed_ms > 0 ? div64_u64(accepted * 1000, elapsed_ms) : 0);
+    }
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(acceptors_stats);
+
+int acceptors_start(enum accept_mode mode, int port, const char *addresses, int (*on_accept)(struct socket *sock))
+{
+    int res;
+
+    acceptor_on_accept = on_accept;
+    switch (mode)
+    {
+    case ACCEPT_SINGLE:
+        max_acceptors = 1;
+        break;
+    case ACCEPT_PER_CPU:
+        max_acceptors = nr_cpu_ids;
+        break;
+    case ACCEPT_PER_ADDR:
+        // one per comma-separated address
+        max_acceptors = 1;
+        for (const char *c = addresses; c && *c; c++)
+            max_acceptors += *c == ',';
+        break;
+    default:
+        pr_err("%s: Invalid accept mode: %d\n", THIS_MODULE->name, mode);
+        return -EINVAL;
+    }
+    acceptors = kcalloc(max_acceptors, sizeof(*acceptors), GFP_KERNEL);
+    if (unlikely(!acceptors))
+        return -ENOMEM;
+
+    switch (mode)
+    {
+    case ACCEPT_SINGLE:
+        res = acceptors_open_single(port, -1);
+        break;
+    case ACCEPT_PER_CPU:
+        res = acceptors_open_per_cpu(port);
+        break;
+    case ACCEPT_PER_ADDR:
+        res = acceptors_open_per_addr(addresses);
+        break;
+    default:
+        res = -EINVAL;
+        break;
+    }
+
+    if (unlikely(res < 0))
+    {
+        pr_err("%s: Failed to start acceptors: %d\n", THIS_MODULE->name, res);
+        acceptors_stop();
+        return res;
+    }
+
+    kserver_stats_create_file("acceptors", &acceptors_stats_fops);
+    pr_info("%s: %d acceptor(s) started\n", THIS_MODULE->name, nr_acceptors);
+    return 0;
+}
+
+void acceptors_stop(void)
+{
+    for (int i = 0; i < nr_acceptors; i++)
+    {
+        struct acceptor *acc = &acceptors[i];
+
+        // shutdown wakes up the acceptor blocked in kernel_accept()
+        WRITE_ONCE(acc->stopping, true);
+        kernel_sock_shutdown(acc->sock, SHUT_RDWR);
+        kthread_stop(acc->thread);
+        sock_release(acc->sock);
+
+        pr_info("%s: acceptor[%d] %s:%d cpu=%d accepted=%llu\n", THIS_MODULE->name, i, acc->ip, acc->port, acc->cpu,
+                atomic64_read(&acc->accepted));
+    }
+    nr_acceptors = 0;
+    kfree(acceptors);
+    acceptors = NULL;
+    max_acceptors = 0;
+}
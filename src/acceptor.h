@@ -0,0 +1,38 @@
+#pragma once
+#include <linux/atomic.h>
+#include <linux/ktime.h>
+#include <linux/net.h>
+#include <linux/sched.h>
+
+enum accept_mode
+{
+    ACCEPT_SINGLE,   // one listener, one unpinned acceptor (historical behavior)
+    ACCEPT_PER_CPU,  // one SO_REUSEPORT listener per online CPU, acceptor pinned on it
+    ACCEPT_PER_ADDR, // one listener per configured IP:PORT, acceptors spread over CPUs
+    ACCEPT_MODE_COUNT,
+};
+
+struct acceptor
+{
+    struct socket *sock;
+    struct task_struct *thread;
+    int cpu; // -1 when not pinned
+    char ip[16];
+    int port;
+    bool stopping;
+    atomic64_t accepted;
+    atomic64_t errors;
+    ktime_t started;
+};
+
+/*
+ * acceptors_start - Open the listener(s) and start one acceptor kthread per listener
+ * @mode: see enum accept_mode
+ * @port: port used by ACCEPT_SINGLE and ACCEPT_PER_CPU
+ * @addresses: comma-separated IP:PORT list used by ACCEPT_PER_ADDR
+ * @on_accept: called from the acceptor for each new connection, on error the socket is released by the acceptor
+ * @return 0 on success, negative error code on failure.
+ */
+int acceptors_start(enum accept_mode mode, int port, const char *addresses, int (*on_accept)(struct socket *sock));
+
+void acceptors_stop(void);
@@ -0,0 +1,88 @@
+#include <linux/module.h>
+
+#include "admission.h"
+#include "client.h"
+#include "stats.h"
+
+static int max_inflight = 0;
+module_param(max_inflight, int, 0644);
+MODULE_PARM_DESC(max_inflight, "Maximum requests in the task graph at once, 0 for no limit (default: 0)");
+
+static int max_inflight_per_conn = 0;
+module_param(max_inflight_per_conn, int, 0644);
+MODULE_PARM_DESC(max_inflight_per_conn, "Maximum requests of one connection in the task graph at once, 0 for no "
+                                        "limit (default: 0)");
+
+static atomic_t inflight = ATOMIC_INIT(0);
+static atomic64_t stat_admitted = ATOMIC64_INIT(0);
+static atomic64_t stat_rejected_global = ATOMIC64_INIT(0);
+static atomic64_t stat_rejected_conn = ATOMIC64_INIT(0);
+static atomic64_t stat_reject_send_failed = ATOMIC64_INIT(0);
+
+/*
+ * Take a slot in counter unless it already reached limit (0: no limit)
+ */
+static bool admission_take(atomic_t *counter, int limit)
+{
+    if (limit <= 0)
+    {
+        atomic_inc(counter);
+        return true;
+    }
+    // the limit may have been lowered under the current count at runtime
+    int cur = atomic_read(counter);
+    do
+    {
+        if (cur >= limit)
+            return false;
+    } while (!atomic_try_cmpxchg(counter, &cur, cur + 1));
+    return true;
+}
+
+int admission_try_enter(struct _client *cl)
+{
+    if (unlikely(!admission_take(&inflight, READ_ONCE(max_inflight))))
+    {
+        atomic64_inc(&stat_rejected_global);
+        return -EBUSY;
+    }
+
+    if (cl && unlikely(!admission_take(&cl->inflight, READ_ONCE(max_inflight_per_conn))))
+    {
+        atomic_dec(&inflight);
+        atomic64_inc(&stat_rejected_conn);
+        return -EBUSY;
+    }
+
+    atomic64_inc(&stat_admitted);
+    return 0;
+}
+
+void admission_exit(struct _client *cl)
+{
+    if (cl)
+        atomic_dec(&cl->inflight);
+    atomic_dec(&inflight);
+}
+
+void admission_reject(struct _client *cl)
+{
+    if (!cl)
+        return;
+    // the reject goes through the tx queue, it never waits for the graph
+    if (unlikely(client_tx_enqueue(cl, ADMISSION_REJECT_MSG, ADMISSION_REJECT_MSG_LEN) < 0))
+        atomic64_inc(&stat_reject_send_failed);
+}
+
+static int admission_stats_show(struct seq_file *m, void *v)
+{
+    seq_printf(m, "inflight=%d max_inflight=%d max_inflight_per_conn=%d\n", atomic_read(&inflight),
+               READ_ONCE(max_inflight), READ_ONCE(max_inflight_per_conn));
+    seq_printf(m, "admitted=%llu rejected_global=%llu rejected_conn=%llu reject_send_failed=%llu\n",
+               atomic64_read(&stat_admitted), atomic64_read(&stat_rejected_global),
+               atomic64_read(&stat_rejected_conn), atomic64_read(&stat_reject_send_failed));
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(admission_stats);
+
+void admission_stats_init(void) { kserver_stats_create_file("admission", &admission_stats_fops); }
@@ -0,0 +1,27 @@
+#pragma once
+#include <linux/types.h>
+
+// sent back instead of the scenario response when a request is rejected
+#define ADMISSION_REJECT_MSG "REJECT"
+#define ADMISSION_REJECT_MSG_LEN 6
+
+struct _client;
+
+/*
+ * admission_try_enter - Account a new request of cl against max_inflight and max_inflight_per_conn
+ * @cl: client sending the request, may be NULL (only the global limit applies)
+ * @return 0 when the request is admitted, -EBUSY when it must be rejected.
+ */
+int admission_try_enter(struct _client *cl);
+
+/*
+ * admission_exit - Release the slot taken by admission_try_enter(), called when the request completes.
+ */
+void admission_exit(struct _client *cl);
+
+/*
+ * admission_reject - Count a rejected request and send the reject response to cl
+ */
+void admission_reject(struct _client *cl);
+
+void admission_stats_init(void);
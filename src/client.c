@@ -0,0 +1,499 @@
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+#include <net/sock.h>
+
+#include "client.h"
+#include "ksocket_handler.h"
+#include "stats.h"
+#include "wq_attrs.h"
+
+static unsigned int max_frame_size = 4096;
+module_param(max_frame_size, uint, 0444);
+MODULE_PARM_DESC(max_frame_size, "Largest frame payload accepted, bigger frames close the connection (default: 4096)");
+
+static struct workqueue_struct *kserver_clients_read;
+static struct workqueue_struct *kserver_clients_write;
+static int (*client_on_frames)(client *cl, struct client_frame *frames, int nr_frames);
+
+static atomic64_t stat_recv_calls = ATOMIC64_INIT(0);
+static atomic64_t stat_recv_bytes = ATOMIC64_INIT(0);
+static atomic64_t stat_frames = ATOMIC64_INIT(0);
+static atomic64_t stat_batches = ATOMIC64_INIT(0);
+static atomic64_t stat_oversized = ATOMIC64_INIT(0);
+static atomic64_t stat_tx_msgs = ATOMIC64_INIT(0);
+static atomic64_t stat_tx_writev = ATOMIC64_INIT(0);
+static atomic64_t stat_tx_dropped = ATOMIC64_INIT(0);
+
+static LIST_HEAD(lclients);
+static DEFINE_SPINLOCK(lclients_lock);
+static atomic64_t stat_closed = ATOMIC64_INIT(0);
+static atomic64_t stat_freed = ATOMIC64_INIT(0);
+
+static void client_tx_free_list(struct list_head *msgs);
+
+static void client_destroy(client *cl)
+{
+    client_tx_free_list(&cl->tx_queue);
+    kernel_sock_shutdown(cl->sock, SHUT_RDWR);
+    sock_release(cl->sock);
+    kfree(cl->rx_buf);
+    kfree(cl);
+}
+
+static void client_release(struct kref *ref)
+{
+    client *cl = container_of(ref, client, ref);
+
+    spin_lock(&lclients_lock);
+    list_del(&cl->list);
+    spin_unlock(&lclients_lock);
+
+    client_destroy(cl);
+    atomic64_inc(&stat_freed);
+}
+
+void client_put(client *cl) { kref_put(&cl->ref, client_release); }
+
+/*
+ * Queued once the client is closed, the callbacks are unhooked so rx_work
+ * can't be queued anymore and client_tx_enqueue refuses new messages
+ */
+static void client_release_work(struct work_struct *work)
+{
+    client *cl = container_of(work, client, release_work);
+
+    cancel_work_sync(&cl->rx_work);
+    // a pending tx_work holds a reference
+    if (cancel_work_sync(&cl->tx_work))
+        client_put(cl);
+    client_put(cl);
+}
+
+static void client_data_ready(struct sock *sk)
+{
+    client *cl;
+
+    read_lock_bh(&sk->sk_callback_lock);
+    cl = sk->sk_user_data;
+    if (likely(cl))
+        queue_work(kserver_clients_read, &cl->rx_work);
+    read_unlock_bh(&sk->sk_callback_lock);
+}
+
+static void client_state_change(struct sock *sk)
+{
+    void (*state_change)(struct sock *sk);
+    client *cl;
+
+    read_lock_bh(&sk->sk_callback_lock);
+    cl = sk->sk_user_data;
+    if (unlikely(!cl))
+    {
+        read_unlock_bh(&sk->sk_callback_lock);
+        return;
+    }
+    state_change = cl->saved_state_change;
+    // a read will return 0 and the rx work will close the client
+    if (sk->sk_state != TCP_ESTABLISHED)
+        queue_work(kserver_clients_read, &cl->rx_work);
+    read_unlock_bh(&sk->sk_callback_lock);
+
+    state_change(sk);
+}
+
+static void client_hook_callbacks(client *cl)
+{
+    struct sock *sk = cl->sock->sk;
+
+    write_lock_bh(&sk->sk_callback_lock);
+    sk->sk_user_data = cl;
+    cl->saved_data_ready = sk->sk_data_ready;
+    cl->saved_state_change = sk->sk_state_change;
+    sk->sk_data_ready = client_data_ready;
+    sk->sk_state_change = client_state_change;
+    write_unlock_bh(&sk->sk_callback_lock);
+}
+
+static void client_unhook_callbacks(client *cl)
+{
+    struct sock *sk = cl->sock->sk;
+
+    write_lock_bh(&sk->sk_callback_lock);
+    if (sk->sk_user_data == cl)
+    {
+        sk->sk_user_data = NULL;
+        sk->sk_data_ready = cl->saved_data_ready;
+        sk->sk_state_change = cl->saved_state_change;
+    }
+    write_unlock_bh(&sk->sk_callback_lock);
+}
+
+static void client_close(client *cl)
+{
+    client_unhook_callbacks(cl);
+    kernel_sock_shutdown(cl->sock, SHUT_RDWR);
+    // the socket itself is released with the last reference, tasks of
+    // the scenario might still use it
+    WRITE_ONCE(cl->closed, true);
+    atomic64_inc(&stat_closed);
+    queue_work(kserver_clients_read, &cl->release_work);
+}
+
+/*
+ * Parse every complete frame of [rx_head, rx_tail), at most CLIENT_RX_BATCH,
+ * returns the number of frames or a negative error on an invalid frame
+ */
+static int client_parse_frames(client *cl, struct client_frame *frames)
+{
+    int nr = 0;
+
+    while (nr < CLIENT_RX_BATCH && cl->rx_tail - cl->rx_head >= CLIENT_FRAME_HDR_LEN)
+    {
+        uint32_t len;
+        memcpy(&len, cl->rx_buf + cl->rx_head, CLIENT_FRAME_HDR_LEN);
+        if (unlikely(len > max_frame_size))
+        {
+            atomic64_inc(&stat_oversized);
+            pr_err("%s: frame of %u bytes exceeds max_frame_size (%u)\n", THIS_MODULE->name, len, max_frame_size);
+            return -EMSGSIZE;
+        }
+
+        if (cl->rx_tail - cl->rx_head - CLIENT_FRAME_HDR_LEN < len)
+            break; // partial frame, wait for more bytes
+
+        frames[nr++] = (struct client_frame){
+            .buf = cl->rx_buf + cl->rx_head + CLIENT_FRAME_HDR_LEN,
+            .len = len,
+        };
+        cl->rx_head += CLIENT_FRAME_HDR_LEN + len;
+    }
+
+    return nr;
+}
+
+/*
+ * Move the trailing partial frame at the start of the buffer, there is
+ * always room for a full frame after this since max_frame_size is bounded
+ * by the buffer size (see clients_init)
+ */
+static void client_rx_compact(client *cl)
+{
+    uint32_t pending = cl->rx_tail - cl->rx_head;
+
+    if (cl->rx_head == 0)
+        return;
+    if (pending)
+        memmove(cl->rx_buf, cl->rx_buf + cl->rx_head, pending);
+    cl->rx_head = 0;
+    cl->rx_tail = pending;
+}
+
+/*
+ * Only queued when the socket has something to read (sk_data_ready), so
+ * the worker never blocks waiting for a client and a handful of workers
+ * can serve every connection.
+ *
+ * One recv pulls everything the socket has (up to the free space of the
+ * buffer), then all the complete frames are handed to the scenario in
+ * batches: pipelined clients cost one recv for many requests.
+ */
+static void client_rx_work(struct work_struct *work)
+{
+    client *cl = container_of(work, client, rx_work);
+    struct client_frame frames[CLIENT_RX_BATCH];
+    int ret;
+
+    if (unlikely(READ_ONCE(cl->closed)))
+        return;
+
+    for (int budget = CLIENT_RX_BUDGET; budget > 0; budget--)
+    {
+        int space = CLIENT_RX_BUF_SIZE - cl->rx_tail;
+
+        ret = ksocket_read((struct ksocket_handler){
+            .sock = cl->sock,
+            .buf = cl->rx_buf + cl->rx_tail,
+            .len = space,
+            .flags = MSG_DONTWAIT,
+        });
+        if (ret == -EAGAIN)
+            return;
+        if (ret <= 0)
+        {
+            if (ret < 0)
+                pr_err("%s: client read failed: %d\n", THIS_MODULE->name, ret);
+            goto close;
+        }
+
+        atomic64_inc(&stat_recv_calls);
+        atomic64_add(ret, &stat_recv_bytes);
+        cl->rx_tail += ret;
+
+        int nr;
+        while ((nr = client_parse_frames(cl, frames)) > 0)
+        {
+            atomic64_add(nr, &stat_frames);
+            atomic64_inc(&stat_batches);
+            if (unlikely(client_on_frames(cl, frames, nr) < 0))
+                goto close;
+        }
+        if (unlikely(nr < 0))
+            goto close;
+
+        client_rx_compact(cl);
+
+        // the socket had less than we could take, it is drained. If bytes
+        // arrive meanwhile sk_data_ready queues us again.
+        if (ret < space)
+            return;
+    }
+
+    // budget exhausted, let the other clients run
+    queue_work(kserver_clients_read, &cl->rx_work);
+    return;
+
+close:
+    client_close(cl);
+}
+
+int client_tx_enqueue(client *cl, const void *buf, uint32_t len)
+{
+    struct client_tx_msg *msg;
+
+    if (unlikely(READ_ONCE(cl->closed)))
+        return -ENOTCONN;
+
+    msg = kmalloc(sizeof(*msg) + len, GFP_KERNEL);
+    if (unlikely(!msg))
+        return -ENOMEM;
+    msg->len = len;
+    memcpy(msg->data, buf, len);
+
+    spin_lock(&cl->tx_lock);
+    list_add_tail(&msg->list, &cl->tx_queue);
+    spin_unlock(&cl->tx_lock);
+
+    atomic64_inc(&stat_tx_msgs);
+    // dropped by client_tx_work, or here when it was already pending
+    client_get(cl);
+    if (!queue_work(kserver_clients_write, &cl->tx_work))
+        client_put(cl);
+    return 0;
+}
+
+static void client_tx_free_list(struct list_head *msgs)
+{
+    struct client_tx_msg *msg, *tmp;
+    list_for_each_entry_safe(msg, tmp, msgs, list)
+    {
+        list_del(&msg->list);
+        kfree(msg);
+    }
+}
+
+/*
+ * Send up to CLIENT_TX_BATCH messages of msgs in one vectored write,
+ * MSG_MORE is set when more messages follow, left in msgs or queued since
+ * the splice, so the stack can fill full segments. Sent messages are freed.
+ */
+static int client_tx_send_batch(client *cl, struct list_head *msgs)
+{
+    struct kvec vec[CLIENT_TX_BATCH];
+    struct client_tx_msg *msg, *tmp;
+    int nr = 0, flags = 0, ret;
+
+    list_for_each_entry(msg, msgs, list)
+    {
+        if (nr == CLIENT_TX_BATCH)
+        {
+            flags = MSG_MORE;
+            break;
+        }
+        vec[nr++] = (struct kvec){.iov_base = msg->data, .iov_len = msg->len};
+    }
+
+    // client_tx_work picks them up right after this write
+    spin_lock(&cl->tx_lock);
+    if (!list_empty(&cl->tx_queue))
+        flags = MSG_MORE;
+    spin_unlock(&cl->tx_lock);
+
+    ret = ksocket_writev((struct ksocket_vhandler){
+        .sock = cl->sock,
+        .vec = vec,
+        .nr_segs = nr,
+        .flags = flags,
+    });
+    atomic64_inc(&stat_tx_writev);
+    if (unlikely(ret < 0))
+        return ret;
+
+    list_for_each_entry_safe(msg, tmp, msgs, list)
+    {
+        if (nr-- == 0)
+            break;
+        list_del(&msg->list);
+        kfree(msg);
+    }
+    return 0;
+}
+
+/*
+ * Only writer of the client socket, cmwq never runs the same work item
+ * concurrently so no lock is held while sending.
+ */
+static void client_tx_work(struct work_struct *work)
+{
+    client *cl = container_of(work, client, tx_work);
+    LIST_HEAD(msgs);
+
+    for (;;)
+    {
+        // a batch sent with MSG_MORE is always followed by another write
+        spin_lock(&cl->tx_lock);
+        list_splice_tail_init(&cl->tx_queue, &msgs);
+        spin_unlock(&cl->tx_lock);
+        if (list_empty(&msgs))
+            break;
+
+        int ret = client_tx_send_batch(cl, &msgs);
+        if (unlikely(ret < 0))
+        {
+            if (!READ_ONCE(cl->closed))
+                pr_err("%s: client send failed: %d\n", THIS_MODULE->name, ret);
+            break;
+        }
+    }
+
+    if (unlikely(!list_empty(&msgs)))
+    {
+        atomic64_add(list_count_nodes(&msgs), &stat_tx_dropped);
+        client_tx_free_list(&msgs);
+    }
+    // may free cl, nothing touches the work item after its function
+    client_put(cl);
+}
+
+static int clients_stats_show(struct seq_file *m, void *v)
+{
+    u64 recv_calls = atomic64_read(&stat_recv_calls);
+    u64 frames = atomic64_read(&stat_frames);
+
+    seq_printf(m, "recv_calls=%llu recv_bytes=%llu frames=%llu batches=%llu oversized=%llu\n", recv_calls,
+               atomic64_read(&stat_recv_bytes), frames, atomic64_read(&stat_batches), atomic64_read(&stat_oversized));
+    seq_printf(m, "frames_per_recv_x100=%llu\n", recv_calls ? div64_u64(frames * 100, recv_calls) : 0);
+    seq_printf(m, "tx_msgs=%llu tx_writev=%llu tx_dropped=%llu\n", atomic64_read(&stat_tx_msgs),
+               atomic64_read(&stat_tx_writev), atomic64_read(&stat_tx_dropped));
+    seq_printf(m, "closed=%llu freed=%llu\n", atomic64_read(&stat_closed), atomic64_read(&stat_freed));
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(clients_stats);
+
+int clients_init(int (*on_frames)(client *cl, struct client_frame *frames, int nr_frames))
+{
+    client_on_frames = on_frames;
+
+    if (max_frame_size > CLIENT_RX_BUF_SIZE - CLIENT_FRAME_HDR_LEN)
+    {
+        pr_warn("%s: max_frame_size capped to %zu\n", THIS_MODULE->name, CLIENT_RX_BUF_SIZE - CLIENT_FRAME_HDR_LEN);
+        max_frame_size = CLIENT_RX_BUF_SIZE - CLIENT_FRAME_HDR_LEN;
+    }
+
+    // flags (WQ_HIGHPRI, WQ_CPU_INTENSIVE...) come from the wq_attrs parameter
+    // https://www.kernel.org/doc/html/next/core-api/workqueue.html#flags
+    kserver_clients_read = kserver_alloc_workqueue("kserver_clients_read", 0);
+    if (unlikely(!kserver_clients_read))
+    {
+        pr_err("%s: Failed to create workqueue\n", THIS_MODULE->name);
+        return -ENOMEM;
+    }
+
+    kserver_clients_write = kserver_alloc_workqueue("kserver_clients_write", 0);
+    if (unlikely(!kserver_clients_write))
+    {
+        pr_err("%s: Failed to create workqueue\n", THIS_MODULE->name);
+        kserver_destroy_workqueue(kserver_clients_read);
+        kserver_clients_read = NULL;
+        return -ENOMEM;
+    }
+
+    kserver_stats_create_file("clients", &clients_stats_fops);
+    return 0;
+}
+
+int client_create(struct socket *sock)
+{
+    client *cl = kzalloc(sizeof(client), GFP_KERNEL);
+    if (unlikely(!cl))
+    {
+        pr_err("%s: Failed to allocate memory for client\n", THIS_MODULE->name);
+        return -ENOMEM;
+    }
+
+    cl->rx_buf = kmalloc(CLIENT_RX_BUF_SIZE, GFP_KERNEL);
+    if (unlikely(!cl->rx_buf))
+    {
+        pr_err("%s: Failed to allocate memory for buffer\n", THIS_MODULE->name);
+        kfree(cl);
+        return -ENOMEM;
+    }
+
+    cl->sock = sock;
+    // the replies are sent blocking from the workers, a stalled reader must not pin them
+    ksocket_set_timeouts(sock);
+    spin_lock_init(&cl->tx_lock);
+    INIT_LIST_HEAD(&cl->tx_queue);
+    INIT_WORK(&cl->rx_work, client_rx_work);
+    INIT_WORK(&cl->tx_work, client_tx_work);
+    INIT_WORK(&cl->release_work, client_release_work);
+    kref_init(&cl->ref);
+
+    spin_lock(&lclients_lock);
+    list_add_tail(&cl->list, &lclients);
+    spin_unlock(&lclients_lock);
+
+    client_hook_callbacks(cl);
+    // bytes may have arrived before the callbacks were in place
+    queue_work(kserver_clients_read, &cl->rx_work);
+    return 0;
+}
+
+void clients_stop(void)
+{
+    client *cl;
+
+    spin_lock(&lclients_lock);
+    list_for_each_entry(cl, &lclients, list)
+    {
+        client_unhook_callbacks(cl);
+        WRITE_ONCE(cl->closed, true);
+    }
+    spin_unlock(&lclients_lock);
+
+    if (kserver_clients_read)
+    {
+        flush_workqueue(kserver_clients_read);
+        kserver_destroy_workqueue(kserver_clients_read);
+        kserver_clients_read = NULL;
+    }
+}
+
+void clients_free(void)
+{
+    client *cl, *tmp;
+
+    if (kserver_clients_write)
+    {
+        kserver_destroy_workqueue(kserver_clients_write);
+        kserver_clients_write = NULL;
+    }
+
+    // nothing runs anymore, the references left belong to requests that
+    // never completed
+    list_for_each_entry_safe(cl, tmp, &lclients, list)
+    {
+        list_del(&cl->list);
+        client_destroy(cl);
+    }
+}
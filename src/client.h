@@ -0,0 +1,98 @@
+#pragma once
+#include <linux/kref.h>
+#include <linux/list.h>
+#include <linux/net.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+#include <linux/workqueue.h>
+#include <net/sock.h>
+
+// a frame is a 4 bytes length (host order) followed by the payload
+#define CLIENT_FRAME_HDR_LEN sizeof(uint32_t)
+#define CLIENT_RX_BUF_SIZE 16384
+// frames handed to the scenario in one call
+#define CLIENT_RX_BATCH 32
+// number of recv done by one rx work run before yielding the worker
+#define CLIENT_RX_BUDGET 64
+// messages coalesced in one sendmsg by the tx work
+#define CLIENT_TX_BATCH 64
+
+struct client_frame
+{
+    void *buf;
+    uint32_t len;
+};
+
+struct client_tx_msg
+{
+    struct list_head list;
+    uint32_t len;
+    u8 data[];
+};
+
+typedef struct _client
+{
+    struct list_head list;     // For linked list
+    struct socket *sock;       // Socket for communication
+    struct work_struct rx_work; // queued by sk_data_ready when bytes are available
+    struct work_struct tx_work; // single writer of sock, drains tx_queue
+    spinlock_t tx_lock;         // protects tx_queue
+    struct list_head tx_queue;  // struct client_tx_msg waiting to be sent
+    atomic_t inflight;          // requests admitted and not completed (see admission.c)
+    bool closed;
+    // held by the connection until it is closed and idle, by every request
+    // (client_request_alloc) and by a pending tx_work
+    struct kref ref;
+    struct work_struct release_work; // drops the connection reference once closed
+
+    // receive buffer, [rx_head, rx_tail) holds bytes not parsed yet
+    u8 *rx_buf;
+    uint32_t rx_head;
+    uint32_t rx_tail;
+
+    void (*saved_data_ready)(struct sock *sk);
+    void (*saved_state_change)(struct sock *sk);
+} client;
+
+/*
+ * clients_init - Create the rx workqueue shared by every client
+ * @on_frames: called from the rx worker with every complete frame parsed from one recv, frames point into the
+ * client receive buffer and are only valid during the call. A negative return closes the client.
+ * @return 0 on success, negative error code on failure.
+ */
+int clients_init(int (*on_frames)(client *cl, struct client_frame *frames, int nr_frames));
+
+/*
+ * client_create - Allocate a client for an accepted socket and hook its sk_data_ready
+ * @return 0 on success, negative error code on failure (socket is left to the caller).
+ */
+int client_create(struct socket *sock);
+
+/*
+ * client_get - Keep cl, its socket included, alive until the matching client_put()
+ */
+static inline void client_get(client *cl) { kref_get(&cl->ref); }
+
+/*
+ * client_put - Drop a reference, a closed client is unlinked and freed with the last one
+ */
+void client_put(client *cl);
+
+/*
+ * client_tx_enqueue - Queue a copy of buf to be sent on the client socket, never sleeps on the socket.
+ * Messages are sent in order by a single writer which coalesces everything pending in one sendmsg.
+ * @return 0 on success, negative error code on failure.
+ */
+int client_tx_enqueue(client *cl, const void *buf, uint32_t len);
+
+/*
+ * clients_stop - Unhook every client socket callback and drain the rx workqueue, after that
+ * no new message will be handed to on_message.
+ */
+void clients_stop(void);
+
+/*
+ * clients_free - Flush pending transmissions and release every client left, including closed ones still referenced
+ * by requests that never completed. Must be called once nothing runs on client sockets anymore.
+ */
+void clients_free(void);
@@ -0,0 +1,267 @@
+#include <linux/jiffies.h>
+#include <linux/module.h>
+#include <linux/string.h>
+#include <net/sock.h>
+#include <net/tcp_states.h>
+
+#include "conn_pool.h"
+#include "ksocket_handler.h"
+#include "page_buf.h"
+#include "stats.h"
+
+static int conn_pool_size = 1;
+module_param(conn_pool_size, int, 0444);
+MODULE_PARM_DESC(conn_pool_size, "Persistent connections kept per subscriber (default: 1, max: 8)");
+
+static int conn_pool_backoff_ms = 100;
+module_param(conn_pool_backoff_ms, int, 0644);
+MODULE_PARM_DESC(conn_pool_backoff_ms, "Initial delay before reconnecting a broken subscriber connection, doubled on "
+                                       "each consecutive failure (default: 100)");
+
+#define CONN_POOL_MAX_BACKOFF_MS 10000
+// iterations of a payload sent by one vectored write
+#define CONN_POOL_SEND_BATCH 16
+
+static struct conn_pool_entry pool[CONN_POOL_MAX_ENTRIES];
+static int nr_entries = 0;
+static DEFINE_MUTEX(pool_lock);
+
+static const char *conn_pool_state_str[] = {
+    [CONN_POOL_DISCONNECTED] = "disconnected",
+    [CONN_POOL_CONNECTED] = "connected",
+    [CONN_POOL_BROKEN] = "broken",
+};
+
+static int conn_pool_stats_show(struct seq_file *m, void *v)
+{
+    for (int i = 0; i < nr_entries; i++)
+    {
+        struct conn_pool_entry *e = &pool[i];
+
+        seq_printf(m, "%s:%d connects=%llu reconnects=%llu sends=%llu errors=%llu\n", e->ip, e->port,
+                   atomic64_read(&e->connects), atomic64_read(&e->reconnects), atomic64_read(&e->sends),
+                   atomic64_read(&e->errors));
+        for (int c = 0; c < e->nr_conns; c++)
+            seq_printf(m, "  conn[%d] state=%s failures=%u\n", c, conn_pool_state_str[READ_ONCE(e->conns[c].state)],
+                       READ_ONCE(e->conns[c].failures));
+    }
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(conn_pool_stats);
+
+struct conn_pool_entry *conn_pool_get(const char *ip, int port)
+{
+    struct conn_pool_entry *e = NULL;
+
+    mutex_lock(&pool_lock);
+    for (int i = 0; i < nr_entries; i++)
+    {
+        if (pool[i].port == port && strcmp(pool[i].ip, ip) == 0)
+        {
+            e = &pool[i];
+            goto out;
+        }
+    }
+
+    if (unlikely(nr_entries == CONN_POOL_MAX_ENTRIES))
+    {
+        pr_err("%s: connection pool is full (max %d subscribers)\n", THIS_MODULE->name, CONN_POOL_MAX_ENTRIES);
+        goto out;
+    }
+
+    if (nr_entries == 0)
+        kserver_stats_create_file("conn_pool", &conn_pool_stats_fops);
+
+    e = &pool[nr_entries++];
+    strscpy(e->ip, ip, sizeof(e->ip));
+    e->port = port;
+    e->nr_conns = clamp(conn_pool_size, 1, CONN_POOL_MAX_CONNS);
+    atomic_set(&e->next, 0);
+    for (int c = 0; c < e->nr_conns; c++)
+    {
+        mutex_init(&e->conns[c].lock);
+        e->conns[c].sock = NULL;
+        e->conns[c].state = CONN_POOL_DISCONNECTED;
+    }
+out:
+    mutex_unlock(&pool_lock);
+    return e;
+}
+
+/*
+ * Take a free connection if any, otherwise wait on the round robin one
+ */
+static struct conn_pool_conn *conn_pool_borrow(struct conn_pool_entry *e)
+{
+    int start = atomic_inc_return(&e->next);
+
+    for (int i = 0; i < e->nr_conns; i++)
+    {
+        struct conn_pool_conn *conn = &e->conns[(start + i) % e->nr_conns];
+        if (mutex_trylock(&conn->lock))
+            return conn;
+    }
+
+    struct conn_pool_conn *conn = &e->conns[start % e->nr_conns];
+    mutex_lock(&conn->lock);
+    return conn;
+}
+
+static void conn_pool_close(struct conn_pool_conn *conn)
+{
+    if (conn->sock)
+    {
+        close_lsocket(conn->sock);
+        conn->sock = NULL;
+    }
+}
+
+static void conn_pool_mark_broken(struct conn_pool_entry *e, struct conn_pool_conn *conn)
+{
+    unsigned int backoff_ms;
+
+    conn_pool_close(conn);
+    conn->failures++;
+    backoff_ms = min_t(unsigned int, conn_pool_backoff_ms << min(conn->failures - 1, 16U), CONN_POOL_MAX_BACKOFF_MS);
+    conn->retry_at = jiffies + msecs_to_jiffies(backoff_ms);
+    WRITE_ONCE(conn->state, CONN_POOL_BROKEN);
+    atomic64_inc(&e->errors);
+}
+
+static bool conn_pool_is_alive(struct conn_pool_conn *conn)
+{
+    struct sock *sk = conn->sock->sk;
+    // the subscriber closed or reset the connection since the last send
+    return READ_ONCE(sk->sk_state) == TCP_ESTABLISHED && !READ_ONCE(sk->sk_err);
+}
+
+/*
+ * Connect the borrowed connection if needed, conn->lock must be held
+ */
+static int conn_pool_connect(struct conn_pool_entry *e, struct conn_pool_conn *conn)
+{
+    int ret;
+
+    if (conn->state == CONN_POOL_CONNECTED)
+    {
+        if (likely(conn_pool_is_alive(conn)))
+            return 0;
+        conn_pool_close(conn);
+        WRITE_ONCE(conn->state, CONN_POOL_DISCONNECTED);
+    }
+
+    if (conn->state == CONN_POOL_BROKEN && time_before(jiffies, conn->retry_at))
+        return -EAGAIN;
+
+    if (conn->state == CONN_POOL_BROKEN)
+        atomic64_inc(&e->reconnects);
+
+    ret = connect_lsocket_addr(&conn->sock, e->ip, e->port);
+    if (unlikely(ret < 0))
+    {
+        conn->sock = NULL;
+        conn_pool_mark_broken(e, conn);
+        return ret;
+    }
+
+    atomic64_inc(&e->connects);
+    conn->failures = 0;
+    WRITE_ONCE(conn->state, CONN_POOL_CONNECTED);
+    return 0;
+}
+
+/*
+ * Write iterations times the payload on the borrowed connection, either
+ * from buf (copied by the stack) or from pb (spliced)
+ */
+static int conn_pool_write(struct conn_pool_conn *conn, void *buf, int len, struct page_buf *pb, int iterations,
+                           int *sent)
+{
+    int ret = 0;
+
+    while (*sent < iterations)
+    {
+        if (pb)
+        {
+            ret = ksocket_sendpages(conn->sock, pb->bvec, pb->nr_pages, pb->len);
+            if (unlikely(ret < 0))
+                return ret;
+            (*sent)++;
+            continue;
+        }
+
+        struct kvec vec[CONN_POOL_SEND_BATCH];
+        int nr = min(iterations - *sent, CONN_POOL_SEND_BATCH);
+
+        for (int i = 0; i < nr; i++)
+            vec[i] = (struct kvec){.iov_base = buf, .iov_len = len};
+
+        ret = ksocket_writev((struct ksocket_vhandler){
+            .sock = conn->sock,
+            .vec = vec,
+            .nr_segs = nr,
+        });
+        if (unlikely(ret < 0))
+            return ret;
+        *sent += nr;
+    }
+    return ret;
+}
+
+static int conn_pool_do_send(struct conn_pool_entry *e, void *buf, int len, struct page_buf *pb, int iterations)
+{
+    struct conn_pool_conn *conn = conn_pool_borrow(e);
+    bool reused;
+    int ret, sent = 0;
+
+retry:
+    reused = conn->state == CONN_POOL_CONNECTED;
+    ret = conn_pool_connect(e, conn);
+    if (unlikely(ret < 0))
+        goto out;
+
+    ret = conn_pool_write(conn, buf, len, pb, iterations, &sent);
+    if (unlikely(ret < 0))
+    {
+        conn_pool_mark_broken(e, conn);
+        // the subscriber may have dropped an idle connection, give a
+        // fresh one a chance before reporting the error
+        if (reused && sent == 0)
+        {
+            conn->retry_at = jiffies;
+            goto retry;
+        }
+        goto out;
+    }
+    atomic64_inc(&e->sends);
+
+out:
+    mutex_unlock(&conn->lock);
+    return ret;
+}
+
+int conn_pool_send(struct conn_pool_entry *e, void *buf, int len, int iterations)
+{
+    return conn_pool_do_send(e, buf, len, NULL, iterations);
+}
+
+int conn_pool_send_pages(struct conn_pool_entry *e, struct page_buf *pb, int iterations)
+{
+    return conn_pool_do_send(e, NULL, 0, pb, iterations);
+}
+
+void conn_pool_free(void)
+{
+    mutex_lock(&pool_lock);
+    for (int i = 0; i < nr_entries; i++)
+    {
+        struct conn_pool_entry *e = &pool[i];
+        for (int c = 0; c < e->nr_conns; c++)
+            conn_pool_close(&e->conns[c]);
+        pr_info("%s: subscriber %s:%d connects=%llu reconnects=%llu sends=%llu errors=%llu\n", THIS_MODULE->name,
+                e->ip, e->port, atomic64_read(&e->connects), atomic64_read(&e->reconnects), atomic64_read(&e->sends),
+                atomic64_read(&e->errors));
+    }
+    nr_entries = 0;
+    mutex_unlock(&pool_lock);
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <linux/atomic.h>
+#include <linux/mutex.h>
+#include <linux/net.h>
+
+#define CONN_POOL_MAX_ENTRIES 16
+#define CONN_POOL_MAX_CONNS 8
+
+enum conn_pool_state
+{
+    CONN_POOL_DISCONNECTED, // never connected or cleanly closed, connect on next borrow
+    CONN_POOL_CONNECTED,
+    CONN_POOL_BROKEN, // last connect/send failed, reconnect once retry_at is reached
+};
+
+struct conn_pool_conn
+{
+    struct mutex lock; // held while the connection is borrowed
+    struct socket *sock;
+    enum conn_pool_state state;
+    unsigned long retry_at; // jiffies
+    unsigned int failures;  // consecutive failures, drives the backoff
+};
+
+/*
+ * Long-lived connections to one subscriber address
+ */
+struct conn_pool_entry
+{
+    char ip[16];
+    int port;
+    int nr_conns;
+    atomic_t next; // round robin over conns
+    struct conn_pool_conn conns[CONN_POOL_MAX_CONNS];
+
+    atomic64_t connects;
+    atomic64_t reconnects;
+    atomic64_t sends;
+    atomic64_t errors;
+};
+
+/*
+ * conn_pool_get - Find or create the pool entry of ip:port, no connection is opened before the first send.
+ * Must be called from init, the returned entry lives until conn_pool_free().
+ * @return the entry or NULL when the pool is full.
+ */
+struct conn_pool_entry *conn_pool_get(const char *ip, int port);
+
+/*
+ * conn_pool_send - Borrow a connection of the entry and send buf iterations times on it.
+ * The connection is (re)connected lazily, a send failing on a reused connection is retried once on a fresh one.
+ * @return last ksocket_write() result, negative error code on failure.
+ */
+int conn_pool_send(struct conn_pool_entry *e, void *buf, int len, int iterations);
+
+struct page_buf;
+/*
+ * conn_pool_send_pages - Same as conn_pool_send() but the payload pages are spliced, never copied.
+ */
+int conn_pool_send_pages(struct conn_pool_entry *e, struct page_buf *pb, int iterations);
+
+void conn_pool_free(void);
@@ -0,0 +1,634 @@
+#include <linux/err.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "client.h"
+#include "dag.h"
+#include "executor.h"
+#include "page_buf.h"
+#include "predictor.h"
+#include "stats.h"
+
+static int dag_tracking = DAG_TRACK_PER_CPU;
+module_param(dag_tracking, int, 0644);
+MODULE_PARM_DESC(dag_tracking, "In-flight request bookkeeping (0: global spinlock, 1: per-CPU lists, default)");
+
+static struct dag_bucket dag_global_bucket;
+static DEFINE_PER_CPU(struct dag_bucket, dag_cpu_buckets);
+
+// template shown in debugfs
+static const struct dag_template *dag_current;
+
+static atomic64_t stat_instances = ATOMIC64_INIT(0);
+static atomic64_t stat_live = ATOMIC64_INIT(0);
+// allocations made for the requests that reached dag_instantiate: the
+// request, the published payload and the instance block
+static atomic64_t stat_allocs = ATOMIC64_INIT(0);
+static atomic64_t stat_setup_ns = ATOMIC64_INIT(0);
+
+static int dag_find_stage(const struct dag_template *t, const char *name)
+{
+    for (int i = 0; i < t->nr_stages; i++)
+        if (strcmp(t->stages[i].name, name) == 0)
+            return i;
+    return -1;
+}
+
+static char *dag_strim(char *s)
+{
+    while (*s == ' ' || *s == '\t')
+        s++;
+    return strim(s);
+}
+
+/*
+ * NAME=OP[(PARAM)]@WORKQUEUE
+ */
+static int dag_parse_stage(struct dag_template *t, char *item)
+{
+    char *name, *op, *wq_name, *param;
+    struct dag_stage *stage;
+    int type;
+
+    if (unlikely(t->nr_stages == DAG_MAX_STAGES))
+    {
+        pr_err("%s: dag: too many stages (max %d)\n", THIS_MODULE->name, DAG_MAX_STAGES);
+        return -E2BIG;
+    }
+
+    name = dag_strim(strsep(&item, "="));
+    wq_name = strchr(item, '@');
+    if (unlikely(!wq_name || !*name))
+    {
+        pr_err("%s: dag: invalid stage %s (expected NAME=OP[(PARAM)]@WORKQUEUE)\n", THIS_MODULE->name, name);
+        return -EINVAL;
+    }
+    *wq_name++ = '\0';
+    wq_name = dag_strim(wq_name);
+
+    if (unlikely(strlen(name) >= DAG_NAME_LEN || strlen(wq_name) >= DAG_NAME_LEN || !*wq_name))
+    {
+        pr_err("%s: dag: invalid stage or workqueue name for %s\n", THIS_MODULE->name, name);
+        return -EINVAL;
+    }
+    if (unlikely(dag_find_stage(t, name) >= 0))
+    {
+        pr_err("%s: dag: duplicated stage %s\n", THIS_MODULE->name, name);
+        return -EINVAL;
+    }
+
+    stage = &t->stages[t->nr_stages];
+    strscpy(stage->name, name, DAG_NAME_LEN);
+    stage->param = 1;
+
+    op = item;
+    param = strchr(op, '(');
+    if (param)
+    {
+        *param++ = '\0';
+        char *end = strchr(param, ')');
+        if (unlikely(!end))
+        {
+            pr_err("%s: dag: missing ')' in stage %s\n", THIS_MODULE->name, name);
+            return -EINVAL;
+        }
+        *end = '\0';
+        if (unlikely(kstrtoint(dag_strim(param), 10, &stage->param) < 0 || stage->param <= 0))
+        {
+            pr_err("%s: dag: invalid parameter in stage %s\n", THIS_MODULE->name, name);
+            return -EINVAL;
+        }
+    }
+
+    op = dag_strim(op);
+    type = task_op_parse(op);
+    if (unlikely(type < 0))
+    {
+        pr_err("%s: dag: unknown op %s in stage %s\n", THIS_MODULE->name, op, name);
+        return -EINVAL;
+    }
+    stage->type = type;
+    stage_batch_init(&stage->batch);
+
+    stage->q = exec_queue_get(wq_name);
+    if (unlikely(!stage->q))
+        return -ENOMEM;
+
+    t->nr_stages++;
+    return 0;
+}
+
+/*
+ * NAME>NAME[,NAME...]
+ */
+static int dag_parse_edge(struct dag_template *t, char *item)
+{
+    char *from_name = dag_strim(strsep(&item, ">"));
+    char *to_name;
+    int from = dag_find_stage(t, from_name);
+
+    if (unlikely(from < 0))
+    {
+        pr_err("%s: dag: unknown stage %s in edge\n", THIS_MODULE->name, from_name);
+        return -EINVAL;
+    }
+
+    while ((to_name = strsep(&item, ",")))
+    {
+        struct dag_stage *stage = &t->stages[from];
+        int to = dag_find_stage(t, dag_strim(to_name));
+
+        if (unlikely(to < 0))
+        {
+            pr_err("%s: dag: unknown stage %s in edge\n", THIS_MODULE->name, to_name);
+            return -EINVAL;
+        }
+        for (int i = 0; i < stage->nr_next; i++)
+        {
+            if (unlikely(stage->next[i] == to))
+            {
+                pr_err("%s: dag: duplicated edge %s>%s\n", THIS_MODULE->name, stage->name, t->stages[to].name);
+                return -EINVAL;
+            }
+        }
+
+        stage->next[stage->nr_next++] = to;
+        t->stages[to].nr_prev++;
+    }
+    return 0;
+}
+
+/*
+ * Check the graph has a single root and no cycle, and lay out the nodes of
+ * an instance in topological order
+ */
+static int dag_layout(struct dag_template *t)
+{
+    int order[DAG_MAX_STAGES], nr_prev[DAG_MAX_STAGES];
+    int head = 0, tail = 0;
+
+    t->root = -1;
+    for (int i = 0; i < t->nr_stages; i++)
+    {
+        nr_prev[i] = t->stages[i].nr_prev;
+        if (nr_prev[i])
+            continue;
+        if (unlikely(t->root >= 0))
+        {
+            pr_err("%s: dag: stages %s and %s both have no predecessor\n", THIS_MODULE->name,
+                   t->stages[t->root].name, t->stages[i].name);
+            return -EINVAL;
+        }
+        t->root = i;
+        order[tail++] = i;
+    }
+    if (unlikely(t->root < 0))
+    {
+        pr_err("%s: dag: no root stage\n", THIS_MODULE->name);
+        return -EINVAL;
+    }
+    if (unlikely(t->stages[t->root].type == TASK_NET_CONN))
+    {
+        pr_err("%s: dag: root stage %s can't be replicated\n", THIS_MODULE->name, t->stages[t->root].name);
+        return -EINVAL;
+    }
+
+    while (head < tail)
+    {
+        struct dag_stage *stage = &t->stages[order[head++]];
+        for (int i = 0; i < stage->nr_next; i++)
+            if (--nr_prev[stage->next[i]] == 0)
+                order[tail++] = stage->next[i];
+    }
+    if (unlikely(tail != t->nr_stages))
+    {
+        pr_err("%s: dag: the graph has a cycle\n", THIS_MODULE->name);
+        return -EINVAL;
+    }
+
+    t->nr_nodes = 0;
+    for (int i = 0; i < t->nr_stages; i++)
+    {
+        struct dag_stage *stage = &t->stages[order[i]];
+        stage->first_node = t->nr_nodes;
+        stage->nr_nodes = stage->type == TASK_NET_CONN ? t->env.nr_subs : 1;
+        t->nr_nodes += stage->nr_nodes;
+    }
+
+    // every predecessor node has to finish before a join is queued, the
+    // levels give the parallelism the graph exposes
+    int level[DAG_MAX_STAGES] = {}, width[DAG_MAX_STAGES] = {};
+    t->depth = 0;
+    t->max_width = 0;
+    for (int i = 0; i < t->nr_stages; i++)
+    {
+        struct dag_stage *stage = &t->stages[order[i]];
+        for (int n = 0; n < stage->nr_next; n++)
+        {
+            struct dag_stage *next = &t->stages[stage->next[n]];
+            next->nr_pred_nodes += stage->nr_nodes;
+            level[stage->next[n]] = max(level[stage->next[n]], level[order[i]] + 1);
+        }
+        width[level[order[i]]] += stage->nr_nodes;
+        t->depth = max(t->depth, level[order[i]] + 1);
+        t->max_width = max(t->max_width, width[level[order[i]]]);
+    }
+
+    for (int i = 0; i < t->nr_stages; i++)
+    {
+        struct dag_stage *stage = &t->stages[i];
+        int nr_next_nodes = 0;
+        for (int n = 0; n < stage->nr_next; n++)
+            nr_next_nodes += t->stages[stage->next[n]].nr_nodes;
+        if (unlikely(nr_next_nodes > MAX_PARALLEL_TASKS))
+        {
+            pr_err("%s: dag: stage %s has %d successors (max %d)\n", THIS_MODULE->name, stage->name, nr_next_nodes,
+                   MAX_PARALLEL_TASKS);
+            return -EINVAL;
+        }
+    }
+    return 0;
+}
+
+static void dag_bucket_init(struct dag_bucket *b)
+{
+    spin_lock_init(&b->lock);
+    INIT_LIST_HEAD(&b->instances);
+    b->acquired = 0;
+    b->contended = 0;
+}
+
+static void dag_buckets_init(void)
+{
+    int cpu;
+
+    dag_bucket_init(&dag_global_bucket);
+    for_each_possible_cpu(cpu)
+        dag_bucket_init(per_cpu_ptr(&dag_cpu_buckets, cpu));
+}
+
+static void dag_bucket_lock(struct dag_bucket *b)
+{
+    bool contended = !spin_trylock(&b->lock);
+    if (contended)
+        spin_lock(&b->lock);
+    b->acquired++;
+    b->contended += contended;
+}
+
+static void dag_instance_track(struct dag_instance *inst)
+{
+    struct dag_bucket *b = READ_ONCE(dag_tracking) == DAG_TRACK_GLOBAL
+                               ? &dag_global_bucket
+                               : per_cpu_ptr(&dag_cpu_buckets, raw_smp_processor_id());
+
+    dag_bucket_lock(b);
+    list_add(&inst->list, &b->instances);
+    spin_unlock(&b->lock);
+    inst->bucket = b;
+}
+
+static void dag_instance_untrack(struct dag_instance *inst)
+{
+    struct dag_bucket *b = inst->bucket;
+
+    dag_bucket_lock(b);
+    list_del(&inst->list);
+    spin_unlock(&b->lock);
+}
+
+static int dag_stats_show(struct seq_file *m, void *v)
+{
+    const struct dag_template *t = dag_current;
+
+    if (!t)
+        return 0;
+
+    s64 instances = atomic64_read(&stat_instances);
+    // the op buffers are per-CPU cached, only their misses allocate, every
+    // ack allocates its tx message
+    s64 allocs = atomic64_read(&stat_allocs) + op_cpu_matrix_nr_allocs() + op_network_nr_allocs();
+    s64 setup_ns = atomic64_read(&stat_setup_ns);
+    s64 saved_ns = 0;
+    s32 allocs_frac;
+    s64 allocs_x100 = instances ? div64_s64(allocs * 100, instances) : 0;
+
+    seq_printf(m, "stages=%d nodes_per_request=%d root=%s instance_size=%zu\n", t->nr_stages, t->nr_nodes,
+               t->stages[t->root].name, t->instance_size);
+    u64 cpu_acquired = 0, cpu_contended = 0;
+    int cpu;
+    for_each_possible_cpu(cpu)
+    {
+        cpu_acquired += READ_ONCE(per_cpu_ptr(&dag_cpu_buckets, cpu)->acquired);
+        cpu_contended += READ_ONCE(per_cpu_ptr(&dag_cpu_buckets, cpu)->contended);
+    }
+    seq_printf(m, "tracking=%s global_acquired=%llu global_contended=%llu percpu_acquired=%llu percpu_contended=%llu\n",
+               READ_ONCE(dag_tracking) == DAG_TRACK_GLOBAL ? "global" : "percpu", READ_ONCE(dag_global_bucket.acquired),
+               READ_ONCE(dag_global_bucket.contended), cpu_acquired, cpu_contended);
+    // average parallelism = work / span, counted in nodes
+    seq_printf(m, "depth=%d max_width=%d parallelism=%d.%02d\n", t->depth, t->max_width, t->nr_nodes / t->depth,
+               t->nr_nodes * 100 / t->depth % 100);
+    seq_printf(m, "instances=%lld live=%lld allocs=%lld allocs_per_request=%lld.%02d setup_ns_avg=%lld\n", instances,
+               atomic64_read(&stat_live), allocs, div_s64_rem(allocs_x100, 100, &allocs_frac), allocs_frac,
+               instances ? div64_s64(setup_ns, instances) : 0);
+    for (int i = 0; i < t->nr_stages; i++)
+    {
+        const struct dag_stage *stage = &t->stages[i];
+        s64 queued = atomic64_read(&stage->stats.queued);
+        s64 fused = atomic64_read(&stage->stats.fused);
+        s64 wait_avg = queued ? div64_s64(atomic64_read(&stage->stats.wait_ns), queued) : 0;
+
+        saved_ns += fused * wait_avg;
+        seq_printf(m,
+                   "%s op=%s param=%d nodes=%d wait=%d queued=%lld fused=%lld queue_wait_ns_avg=%lld "
+                   "deadline_missed=%lld timed_out=%lld cancelled=%lld batches=%lld batched=%lld next=",
+                   stage->name, task_op_name(stage->type), stage->param, stage->nr_nodes, stage->nr_pred_nodes, queued,
+                   fused, wait_avg, atomic64_read(&stage->stats.deadline_missed),
+                   atomic64_read(&stage->stats.timed_out), atomic64_read(&stage->stats.cancelled),
+                   atomic64_read(&stage->stats.batches), atomic64_read(&stage->stats.batched));
+        for (int n = 0; n < stage->nr_next; n++)
+            seq_printf(m, "%s%s", n ? "," : "", t->stages[stage->next[n]].name);
+        seq_putc(m, '\n');
+    }
+    // a fused hop saves about the average queueing delay of its stage
+    seq_printf(m, "fusion_saved_ns_per_request=%lld\n", instances ? div64_s64(saved_ns, instances) : 0);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(dag_stats);
+
+static int dag_build_image(struct dag_template *t);
+
+struct dag_template *dag_template_compile(const char *spec, const struct dag_env *env)
+{
+    struct dag_template *t;
+    char *spec_copy, *ptr, *item;
+    int res = 0;
+
+    t = kzalloc(sizeof(*t), GFP_KERNEL);
+    spec_copy = kstrdup(spec, GFP_KERNEL);
+    if (unlikely(!t || !spec_copy))
+    {
+        kfree(t);
+        kfree(spec_copy);
+        return ERR_PTR(-ENOMEM);
+    }
+    t->env = *env;
+    dag_buckets_init();
+
+    // stages first, edges reference them by name
+    ptr = spec_copy;
+    while ((item = strsep(&ptr, ";")))
+    {
+        item = dag_strim(item);
+        if (!*item || !strchr(item, '='))
+            continue;
+        res = dag_parse_stage(t, item);
+        if (unlikely(res < 0))
+            goto err;
+    }
+
+    strcpy(spec_copy, spec);
+    ptr = spec_copy;
+    while ((item = strsep(&ptr, ";")))
+    {
+        item = dag_strim(item);
+        if (!*item || strchr(item, '='))
+            continue;
+        if (unlikely(!strchr(item, '>')))
+        {
+            pr_err("%s: dag: invalid item %s\n", THIS_MODULE->name, item);
+            res = -EINVAL;
+            goto err;
+        }
+        res = dag_parse_edge(t, item);
+        if (unlikely(res < 0))
+            goto err;
+    }
+
+    if (unlikely(t->nr_stages == 0))
+    {
+        pr_err("%s: dag: no stage in %s\n", THIS_MODULE->name, spec);
+        res = -EINVAL;
+        goto err;
+    }
+
+    res = dag_layout(t);
+    if (unlikely(res < 0))
+        goto err;
+
+    res = dag_build_image(t);
+    if (unlikely(res < 0))
+        goto err;
+
+    kfree(spec_copy);
+    dag_current = t;
+    kserver_stats_create_file("dag", &dag_stats_fops);
+    pr_info("%s: dag: %d stages, %d nodes per request\n", THIS_MODULE->name, t->nr_stages, t->nr_nodes);
+    return t;
+
+err:
+    kfree(spec_copy);
+    exec_queues_free();
+    kfree(t);
+    return ERR_PTR(res);
+}
+
+/*
+ * Fill the arguments of the r-th node of stage, everything that doesn't depend on the request
+ */
+static void dag_fill_node(const struct dag_template *t, const struct dag_stage *stage, int r, struct client_work *cw)
+{
+    switch (stage->type)
+    {
+    case TASK_CPU:
+        cw->t.args.cpu_args.args.matrix_multiplication.size = stage->param;
+        break;
+    case TASK_DISK:
+        cw->t.args.disk_args = (op_disk_args_t){
+            .filename = "/tmp/mom_disk_write.txt",
+            .args.write = {.to_write = "hello_world_something", .len_to_write = 22, .iterations = stage->param},
+        };
+        break;
+    case TASK_NET:
+        cw->t.args.net_args = (op_network_args_t){
+            .args.send = {.payload = t->env.ack_msg, .size_payload = t->env.ack_msg_len, .iterations = stage->param},
+        };
+        break;
+    case TASK_NET_CONN:
+        cw->t.args.net_args = (op_network_args_t){
+            .args.conn_send = {.ip = t->env.subs[r].ip,
+                               .port = t->env.subs[r].port,
+                               .pool = t->env.subs[r].pool,
+                               .iterations = stage->param},
+        };
+        break;
+    }
+}
+
+/*
+ * Build the instance copied by dag_instantiate and its slab cache
+ */
+static int dag_build_image(struct dag_template *t)
+{
+    struct dag_instance *image;
+
+    t->instance_size = struct_size(image, nodes, t->nr_nodes);
+    image = kzalloc(t->instance_size, GFP_KERNEL);
+    if (unlikely(!image))
+        return -ENOMEM;
+    image->t = t;
+    image->nr_nodes = t->nr_nodes;
+
+    for (int s = 0; s < t->nr_stages; s++)
+    {
+        const struct dag_stage *stage = &t->stages[s];
+        for (int r = 0; r < stage->nr_nodes; r++)
+        {
+            struct client_work *cw = &image->nodes[stage->first_node + r];
+
+            cw->type = stage->type;
+            cw->stats = &t->stages[s].stats;
+            cw->pred = predictor_get(stage->type, stage->param);
+            // the arguments of the other ops depend on the node or the request
+            if (stage->type == TASK_CPU)
+                cw->batch = &t->stages[s].batch;
+            dag_fill_node(t, stage, r, cw);
+            atomic_set(&cw->pending_preds, stage->nr_pred_nodes);
+            for (int n = 0; n < stage->nr_next; n++)
+            {
+                const struct dag_stage *next = &t->stages[stage->next[n]];
+                for (int q = 0; q < next->nr_nodes; q++)
+                    cw->next_works[cw->total_next_workqueue++] = (struct next_workqueue){
+                        .q = next->q,
+                        .cw = &image->nodes[next->first_node + q],
+                    };
+            }
+        }
+    }
+
+    t->cache = kmem_cache_create("kserver_dag_instance", t->instance_size, 0, 0, NULL);
+    if (unlikely(!t->cache))
+    {
+        kfree(image);
+        return -ENOMEM;
+    }
+    t->image = image;
+    return 0;
+}
+
+int dag_instantiate(const struct dag_template *t, struct client_request *req, struct page_buf *pb)
+{
+    u64 start = ktime_get_ns();
+    struct dag_instance *inst = kmem_cache_alloc(t->cache, GFP_KERNEL);
+    if (unlikely(!inst))
+    {
+        pr_err("%s: Failed to allocate memory for a dag instance\n", THIS_MODULE->name);
+        return -ENOMEM;
+    }
+
+    memcpy(inst, t->image, t->instance_size);
+    for (int s = 0; s < t->nr_stages; s++)
+    {
+        const struct dag_stage *stage = &t->stages[s];
+        for (int r = 0; r < stage->nr_nodes; r++)
+        {
+            struct client_work *cw = &inst->nodes[stage->first_node + r];
+
+            cw->req = req;
+            // successors were copied pointing into the image
+            for (int n = 0; n < cw->total_next_workqueue; n++)
+                cw->next_works[n].cw = inst->nodes + (cw->next_works[n].cw - t->image->nodes);
+
+            if (stage->type == TASK_NET)
+            {
+                cw->t.args.net_args.sock = req->cl ? req->cl->sock : NULL;
+                cw->t.args.net_args.client = req->cl;
+            }
+            else if (stage->type == TASK_NET_CONN && pb)
+            {
+                page_buf_get(pb);
+                cw->t.args.net_args.args.conn_send.pages = pb;
+                cw->t.args.net_args.args.conn_send.size_payload = pb->len;
+            }
+        }
+    }
+
+    dag_instance_track(inst);
+    req->inst = inst;
+
+    const struct dag_stage *root = &t->stages[t->root];
+    struct client_work *cw = &inst->nodes[root->first_node];
+
+    atomic64_inc(&stat_instances);
+    atomic64_inc(&stat_live);
+    // client_request_alloc, page_buf_alloc (header and pages) and this block
+    atomic64_add(2 + (pb ? 1 + pb->nr_pages : 0), &stat_allocs);
+    atomic64_add(ktime_get_ns() - start, &stat_setup_ns);
+
+    client_request_queue(req, root->q, cw);
+    return 0;
+}
+
+/*
+ * Drop the payload references of the notify nodes that never ran (failed
+ * predecessor) and give the block back
+ */
+static void dag_instance_destroy(const struct dag_template *t, struct dag_instance *inst)
+{
+    for (int s = 0; s < t->nr_stages; s++)
+    {
+        const struct dag_stage *stage = &t->stages[s];
+        if (stage->type != TASK_NET_CONN)
+            continue;
+        for (int r = 0; r < stage->nr_nodes; r++)
+            page_buf_put(inst->nodes[stage->first_node + r].t.args.net_args.args.conn_send.pages);
+    }
+
+    kmem_cache_free(t->cache, inst);
+    atomic64_dec(&stat_live);
+}
+
+void dag_instance_release(struct dag_instance *inst)
+{
+    dag_instance_untrack(inst);
+    dag_instance_destroy(inst->t, inst);
+}
+
+static int dag_bucket_drain(const struct dag_template *t, struct dag_bucket *b)
+{
+    struct dag_instance *inst, *tmp;
+    int counter = 0;
+
+    list_for_each_entry_safe(inst, tmp, &b->instances, list)
+    {
+        list_del(&inst->list);
+        dag_instance_destroy(t, inst);
+        counter++;
+    }
+    return counter;
+}
+
+void dag_template_free(struct dag_template *t)
+{
+    int counter = 0;
+    int cpu;
+
+    exec_queues_free();
+    if (dag_current == t)
+        dag_current = NULL;
+
+    // workqueues are drained, only instances of requests that never
+    // completed are left
+    counter += dag_bucket_drain(t, &dag_global_bucket);
+    for_each_possible_cpu(cpu)
+        counter += dag_bucket_drain(t, per_cpu_ptr(&dag_cpu_buckets, cpu));
+    pr_info("%s: Freed %d dag instances still live\n", THIS_MODULE->name, counter);
+
+    kmem_cache_destroy(t->cache);
+    kfree(t->image);
+    kfree(t);
+}
@@ -0,0 +1,131 @@
+#pragma once
+#include <linux/types.h>
+#include <linux/workqueue.h>
+
+#include "task.h"
+
+#define DAG_MAX_STAGES 16
+#define DAG_NAME_LEN 32
+
+struct conn_pool_entry;
+struct page_buf;
+
+/*
+ * Destination of the stages replicated per subscriber (notify)
+ */
+struct dag_subscriber
+{
+    char *ip;
+    int port;
+    struct conn_pool_entry *pool;
+};
+
+/*
+ * What a template needs from its scenario to fill the nodes of a request
+ */
+struct dag_env
+{
+    const struct dag_subscriber *subs;
+    int nr_subs;
+    char *ack_msg; // payload of ack stages
+    int ack_msg_len;
+};
+
+struct dag_stage
+{
+    char name[DAG_NAME_LEN];
+    enum task_type type;
+    int param; // cpu: matrix size, disk/ack/notify: iterations
+    struct exec_queue *q;
+    int nr_next;
+    int next[DAG_MAX_STAGES]; // successor stages
+    int nr_prev;
+    int nr_pred_nodes; // predecessor nodes a node of the stage waits for (join)
+    struct stage_stats stats;
+    struct stage_batch batch; // used by the cpu stages only
+    // nodes of the stage in an instance, notify is replicated per subscriber
+    int first_node;
+    int nr_nodes;
+};
+
+enum dag_tracking
+{
+    DAG_TRACK_GLOBAL, // one list and spinlock shared by all CPUs
+    DAG_TRACK_PER_CPU,
+};
+
+/*
+ * In-flight instances, only walked at teardown
+ */
+struct dag_bucket
+{
+    spinlock_t lock;
+    struct list_head instances;
+    u64 acquired;  // under lock
+    u64 contended; // acquisitions that had to spin, under lock
+};
+
+/*
+ * All the client_work of one request, allocated as a single block
+ */
+struct dag_instance
+{
+    struct list_head list;
+    struct dag_bucket *bucket; // where list is linked, may be another CPU's at release
+    const struct dag_template *t;
+    int nr_nodes;
+    struct client_work nodes[];
+};
+
+/*
+ * Immutable once compiled, every request of the scenario is an instance of it
+ */
+struct dag_template
+{
+    struct dag_env env;
+    int nr_stages;
+    int root;
+    int nr_nodes; // client_work per instance
+    int depth;     // stages on the longest path
+    int max_width; // most nodes that can run at the same time
+    struct dag_stage stages[DAG_MAX_STAGES];
+    // prefilled instance copied for every request, only the request, the
+    // successor pointers and the payload are fixed up afterwards
+    struct dag_instance *image;
+    size_t instance_size;
+    struct kmem_cache *cache;
+};
+
+/*
+ * dag_template_compile - Parse a DAG description and build its template, the stage queues named in the description
+ * are created if needed (see executor.h).
+ *
+ * The description is a ';' separated list of stages and edges:
+ *   stage: NAME=OP[(PARAM)]@QUEUE   OP is cpu, disk, ack or notify
+ *   edge:  NAME>NAME[,NAME...]
+ * e.g. "read=cpu(100)@first;cpu=cpu(100)@second;notify=notify(1)@third;read>cpu;cpu>notify"
+ * There must be exactly one stage without predecessor (the root) and no cycle. A stage with several predecessors
+ * is a join, it is queued by the last of them to finish. notify stages are replicated per subscriber, their
+ * successors wait for every replica.
+ *
+ * @return the template or an ERR_PTR() on invalid description.
+ */
+struct dag_template *dag_template_compile(const char *spec, const struct dag_env *env);
+
+/*
+ * dag_instantiate - Create the client_work of one request from the template (one allocation) and queue the root
+ * @pb: Optional, payload sent by notify stages, each notify node takes its own reference
+ * @return 0 on success, negative error code on failure (nothing has been queued then).
+ */
+int dag_instantiate(const struct dag_template *t, struct client_request *req, struct page_buf *pb);
+
+/*
+ * dag_instance_release - Return the client_work of a completed request to the template cache, called by
+ * client_request_complete().
+ */
+void dag_instance_release(struct dag_instance *inst);
+
+/*
+ * dag_template_free - Drain and destroy the stage queues of the template, then free it with its instances.
+ */
+void dag_template_free(struct dag_template *t);
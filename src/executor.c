@@ -0,0 +1,610 @@
+#include <linux/cpumask.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/list_sort.h>
+#include <linux/llist.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/version.h>
+#include <linux/wait.h>
+#include <linux/wait_bit.h>
+#include <linux/workqueue.h>
+
+#include "executor.h"
+#include "stats.h"
+#include "task.h"
+#include "wq_attrs.h"
+
+static int executor = EXEC_CMWQ;
+module_param(executor, int, 0444);
+MODULE_PARM_DESC(executor, "Backend running the stages (0: cmwq, default, 1: kthread_worker per stage, 2: per-CPU "
+                           "kthreads per stage, 3: work-stealing per-CPU kthreads per stage)");
+
+static const char *const exec_backend_names[] = {
+    [EXEC_CMWQ] = "cmwq",
+    [EXEC_KTHREAD_WORKER] = "kthread_worker",
+    [EXEC_PERCPU_KTHREAD] = "percpu_kthread",
+    [EXEC_WORK_STEALING] = "work_stealing",
+};
+
+/*
+ * Run queue of one pinned kthread
+ */
+struct exec_rq
+{
+    struct llist_head list;
+    wait_queue_head_t wait;
+    struct task_struct *thread;
+};
+
+/*
+ * Deque of one work-stealing kthread, the owner pushes and pops at the
+ * tail, thieves take the oldest entry at the head
+ */
+struct exec_ws_rq
+{
+    spinlock_t lock;
+    struct list_head deque;
+    int len;
+    int max_len;
+    bool idle;
+    bool kicked; // a peer has a backlog to steal, see exec_ws_queue
+    wait_queue_head_t wait;
+    struct task_struct *thread;
+    u64 executed; // by the owner, local or stolen
+    u64 stolen;   // taken from other CPUs
+};
+
+struct exec_queue
+{
+    char name[EXEC_NAME_LEN];
+    enum exec_backend backend;
+    union
+    {
+        struct workqueue_struct *wq;
+        struct kthread_worker *worker;
+        struct exec_rq __percpu *rqs;
+        struct exec_ws_rq __percpu *ws;
+    };
+    struct workqueue_struct *wq_hi; // cmwq: HIGHPRI sibling for the urgent client_work
+    atomic64_t urgent;
+    atomic_t nr_idle; // work-stealing threads waiting for work
+    atomic64_t steal_failed;
+    atomic64_t queued;
+    atomic64_t executed;
+    atomic64_t wait_ns; // exec_queue_work to execution
+};
+
+static struct exec_queue exec_queues[EXEC_MAX_QUEUES];
+static int nr_exec_queues = 0;
+
+// client_work queued on any stage queue and not done running, successors
+// are queued before their predecessor is done so it only drops to 0 once
+// every queue is idle
+static atomic_t exec_pending = ATOMIC_INIT(0);
+
+static void exec_run(struct exec_queue *q, struct client_work *cw)
+{
+    atomic64_inc(&q->executed);
+    atomic64_add(ktime_get_ns() - cw->exec_queued_at, &q->wait_ns);
+    // cw may be freed once it ran
+    client_work_exec(cw);
+    if (atomic_dec_and_test(&exec_pending))
+        wake_up_var(&exec_pending);
+}
+
+/*
+ * cmwq
+ */
+static void exec_cmwq_fn(struct work_struct *work)
+{
+    struct client_work *cw = container_of(work, struct client_work, work);
+    exec_run(cw->exec_q, cw);
+}
+
+static int exec_cmwq_create(struct exec_queue *q)
+{
+    char name_hi[EXEC_NAME_LEN];
+
+    // a truncated suffix would collide with the base name
+    if (snprintf(name_hi, sizeof(name_hi), "%s_hi", q->name) >= sizeof(name_hi))
+    {
+        pr_err("%s: stage queue name %s too long for its _hi sibling (max %zu)\n", THIS_MODULE->name, q->name,
+               sizeof(name_hi) - 4);
+        return -ENAMETOOLONG;
+    }
+
+    q->wq = kserver_alloc_workqueue(q->name, 0);
+    if (!q->wq)
+        return -ENOMEM;
+
+    // urgent work stays on the CPUs configured for the stage
+    q->wq_hi = kserver_alloc_workqueue_as(name_hi, q->name, WQ_HIGHPRI);
+    if (!q->wq_hi)
+    {
+        kserver_destroy_workqueue(q->wq);
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+static void exec_cmwq_queue(struct exec_queue *q, int cpu, struct client_work *cw)
+{
+    struct workqueue_struct *wq = q->wq;
+
+    // close to its deadline, overtakes the normal priority backlog
+    if (client_work_urgent(cw))
+    {
+        wq = q->wq_hi;
+        atomic64_inc(&q->urgent);
+    }
+
+    INIT_WORK(&cw->work, exec_cmwq_fn);
+    queue_work_on(cpu, wq, &cw->work);
+}
+
+static void exec_cmwq_destroy(struct exec_queue *q)
+{
+    kserver_destroy_workqueue(q->wq);
+    kserver_destroy_workqueue(q->wq_hi);
+}
+
+/*
+ * kthread_worker
+ */
+static void exec_kworker_fn(struct kthread_work *work)
+{
+    struct client_work *cw = container_of(work, struct client_work, kwork);
+    exec_run(cw->exec_q, cw);
+}
+
+static int exec_kworker_create(struct exec_queue *q)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 14, 0)
+    q->worker = kthread_run_worker(0, "kserver_%s", q->name);
+#else
+    q->worker = kthread_create_worker(0, "kserver_%s", q->name);
+#endif
+    if (IS_ERR(q->worker))
+    {
+        int ret = PTR_ERR(q->worker);
+        q->worker = NULL;
+        return ret;
+    }
+    return 0;
+}
+
+static void exec_kworker_queue(struct exec_queue *q, int cpu, struct client_work *cw)
+{
+    kthread_init_work(&cw->kwork, exec_kworker_fn);
+    kthread_queue_work(q->worker, &cw->kwork);
+}
+
+static void exec_kworker_destroy(struct exec_queue *q)
+{
+    // flushes the pending work first
+    kthread_destroy_worker(q->worker);
+}
+
+static int exec_deadline_cmp(void *priv, const struct list_head *a, const struct list_head *b)
+{
+    u64 da = client_work_deadline(list_entry(a, struct client_work, ws_node));
+    u64 db = client_work_deadline(list_entry(b, struct client_work, ws_node));
+
+    // no deadline runs last, list_sort is stable so FIFO order is kept
+    // among equal deadlines
+    return (da ?: U64_MAX) > (db ?: U64_MAX);
+}
+
+/*
+ * per-CPU kthreads, producers push on the llist of the CPU, the thread
+ * pops everything at once and runs the batch earliest deadline first
+ */
+static int exec_rq_thread(void *data)
+{
+    struct exec_rq *rq = data;
+
+    for (;;)
+    {
+        wait_event_interruptible(rq->wait, !llist_empty(&rq->list) || kthread_should_stop());
+
+        struct llist_node *node = llist_reverse_order(llist_del_all(&rq->list));
+        struct client_work *cw, *tmp;
+        LIST_HEAD(batch);
+
+        // stopped only once drained, like destroy_workqueue
+        if (!node && kthread_should_stop())
+            break;
+
+        // ws_node overlays rq_node, next was read by the _safe iteration
+        llist_for_each_entry_safe(cw, tmp, node, rq_node)
+            list_add_tail(&cw->ws_node, &batch);
+        list_sort(NULL, &batch, exec_deadline_cmp);
+
+        list_for_each_entry_safe(cw, tmp, &batch, ws_node)
+            exec_run(cw->exec_q, cw);
+        cond_resched();
+    }
+    return 0;
+}
+
+static void exec_percpu_destroy(struct exec_queue *q);
+
+/*
+ * kthread_create_on_cpu() only formats the cpu in the name, the stage name
+ * goes in too so that each stage's threads can be told apart. The comm is
+ * truncated to TASK_COMM_LEN.
+ */
+static struct task_struct *exec_create_thread(int (*fn)(void *), void *data, struct exec_queue *q, int cpu)
+{
+    struct task_struct *thread =
+        kthread_create_on_node(fn, data, cpu_to_node(cpu), "kserver_%s/%u", q->name, cpu);
+
+    if (!IS_ERR(thread))
+        kthread_bind(thread, cpu);
+    return thread;
+}
+
+static int exec_percpu_create(struct exec_queue *q)
+{
+    int cpu;
+
+    q->rqs = alloc_percpu(struct exec_rq);
+    if (!q->rqs)
+        return -ENOMEM;
+
+    for_each_possible_cpu(cpu)
+    {
+        struct exec_rq *rq = per_cpu_ptr(q->rqs, cpu);
+        init_llist_head(&rq->list);
+        init_waitqueue_head(&rq->wait);
+        rq->thread = NULL;
+    }
+
+    for_each_online_cpu(cpu)
+    {
+        struct exec_rq *rq = per_cpu_ptr(q->rqs, cpu);
+        struct task_struct *thread = exec_create_thread(exec_rq_thread, rq, q, cpu);
+        if (IS_ERR(thread))
+        {
+            pr_err("%s: Failed to create the %s thread of cpu %d\n", THIS_MODULE->name, q->name, cpu);
+            exec_percpu_destroy(q);
+            return PTR_ERR(thread);
+        }
+        rq->thread = thread;
+        wake_up_process(thread);
+    }
+    return 0;
+}
+
+static void exec_percpu_queue(struct exec_queue *q, int cpu, struct client_work *cw)
+{
+    struct exec_rq *rq;
+
+    if (cpu == WORK_CPU_UNBOUND)
+        cpu = raw_smp_processor_id();
+    rq = per_cpu_ptr(q->rqs, cpu);
+    // no thread on a CPU that was offline at creation
+    if (unlikely(!rq->thread))
+        rq = per_cpu_ptr(q->rqs, cpumask_first(cpu_online_mask));
+
+    if (llist_add(&cw->rq_node, &rq->list))
+        wake_up(&rq->wait);
+}
+
+static void exec_percpu_destroy(struct exec_queue *q)
+{
+    int cpu;
+
+    for_each_possible_cpu(cpu)
+    {
+        struct exec_rq *rq = per_cpu_ptr(q->rqs, cpu);
+        if (rq->thread)
+            kthread_stop(rq->thread);
+        rq->thread = NULL;
+    }
+    free_percpu(q->rqs);
+    q->rqs = NULL;
+}
+
+/*
+ * work-stealing per-CPU kthreads
+ */
+static struct client_work *exec_ws_pop(struct exec_ws_rq *rq, bool steal)
+{
+    struct client_work *cw = NULL;
+
+    spin_lock(&rq->lock);
+    if (!list_empty(&rq->deque))
+    {
+        cw = steal ? list_first_entry(&rq->deque, struct client_work, ws_node)
+                   : list_last_entry(&rq->deque, struct client_work, ws_node);
+        list_del(&cw->ws_node);
+        WRITE_ONCE(rq->len, rq->len - 1);
+    }
+    spin_unlock(&rq->lock);
+    return cw;
+}
+
+static bool exec_ws_stealable(struct exec_ws_rq *victim)
+{
+    // a single pending entry is left to its owner, it is about to run it
+    return victim->thread && READ_ONCE(victim->len) >= (READ_ONCE(victim->idle) ? 1 : 2);
+}
+
+static struct client_work *exec_ws_steal(struct exec_queue *q, int self)
+{
+    bool candidate = false;
+
+    for (int i = 1; i < nr_cpu_ids; i++)
+    {
+        int cpu = (self + i) % nr_cpu_ids;
+        struct exec_ws_rq *victim;
+        struct client_work *cw;
+
+        if (!cpu_online(cpu))
+            continue;
+        victim = per_cpu_ptr(q->ws, cpu);
+        if (!exec_ws_stealable(victim))
+            continue;
+
+        candidate = true;
+        cw = exec_ws_pop(victim, true);
+        if (cw)
+            return cw;
+    }
+    // every victim seen was emptied by its owner or another thief first
+    if (candidate)
+        atomic64_inc(&q->steal_failed);
+    return NULL;
+}
+
+static bool exec_ws_backlog(struct exec_queue *q, int self)
+{
+    int cpu;
+
+    for_each_online_cpu(cpu)
+        if (cpu != self && exec_ws_stealable(per_cpu_ptr(q->ws, cpu)))
+            return true;
+    return false;
+}
+
+static int exec_ws_thread(void *data)
+{
+    struct exec_queue *q = data;
+    int self = raw_smp_processor_id();
+    struct exec_ws_rq *rq = per_cpu_ptr(q->ws, self);
+
+    for (;;)
+    {
+        struct client_work *cw = exec_ws_pop(rq, false);
+        if (!cw && !kthread_should_stop())
+        {
+            cw = exec_ws_steal(q, self);
+            if (cw)
+                rq->stolen++;
+        }
+
+        if (cw)
+        {
+            rq->executed++;
+            exec_run(q, cw);
+            cond_resched();
+            continue;
+        }
+
+        // stopped only once the local deque is drained
+        if (kthread_should_stop())
+            break;
+
+        WRITE_ONCE(rq->idle, true);
+        atomic_inc(&q->nr_idle);
+        // pairs with the barrier of exec_ws_queue: a backlog pushed before
+        // idle was visible, whose owner did not kick us, is seen here
+        smp_mb__after_atomic();
+        if (!exec_ws_backlog(q, self))
+            wait_event_interruptible(rq->wait,
+                                     READ_ONCE(rq->len) || READ_ONCE(rq->kicked) || kthread_should_stop());
+        WRITE_ONCE(rq->kicked, false);
+        atomic_dec(&q->nr_idle);
+        WRITE_ONCE(rq->idle, false);
+    }
+    return 0;
+}
+
+static void exec_ws_destroy(struct exec_queue *q);
+
+static int exec_ws_create(struct exec_queue *q)
+{
+    int cpu;
+
+    q->ws = alloc_percpu(struct exec_ws_rq);
+    if (!q->ws)
+        return -ENOMEM;
+
+    for_each_possible_cpu(cpu)
+    {
+        struct exec_ws_rq *rq = per_cpu_ptr(q->ws, cpu);
+        memset(rq, 0, sizeof(*rq));
+        spin_lock_init(&rq->lock);
+        INIT_LIST_HEAD(&rq->deque);
+        init_waitqueue_head(&rq->wait);
+    }
+
+    for_each_online_cpu(cpu)
+    {
+        struct exec_ws_rq *rq = per_cpu_ptr(q->ws, cpu);
+        struct task_struct *thread = exec_create_thread(exec_ws_thread, q, q, cpu);
+        if (IS_ERR(thread))
+        {
+            pr_err("%s: Failed to create the %s thread of cpu %d\n", THIS_MODULE->name, q->name, cpu);
+            exec_ws_destroy(q);
+            return PTR_ERR(thread);
+        }
+        rq->thread = thread;
+        wake_up_process(thread);
+    }
+    return 0;
+}
+
+static void exec_ws_queue(struct exec_queue *q, int cpu, struct client_work *cw)
+{
+    struct exec_ws_rq *rq;
+    int len;
+
+    if (cpu == WORK_CPU_UNBOUND)
+        cpu = raw_smp_processor_id();
+    rq = per_cpu_ptr(q->ws, cpu);
+    if (unlikely(!rq->thread))
+        rq = per_cpu_ptr(q->ws, cpumask_first(cpu_online_mask));
+
+    spin_lock(&rq->lock);
+    list_add_tail(&cw->ws_node, &rq->deque);
+    len = rq->len + 1;
+    WRITE_ONCE(rq->len, len);
+    if (len > rq->max_len)
+        rq->max_len = len;
+    spin_unlock(&rq->lock);
+
+    // pairs with the barrier of exec_ws_thread before it sleeps
+    smp_mb();
+    if (READ_ONCE(rq->idle))
+    {
+        wake_up(&rq->wait);
+        return;
+    }
+    if (len < 2 || !atomic_read(&q->nr_idle))
+        return;
+
+    // the owner is busy and has a backlog, wake an idle thief
+    for_each_online_cpu(cpu)
+    {
+        struct exec_ws_rq *peer = per_cpu_ptr(q->ws, cpu);
+        if (peer->thread && READ_ONCE(peer->idle))
+        {
+            WRITE_ONCE(peer->kicked, true);
+            wake_up(&peer->wait);
+            break;
+        }
+    }
+}
+
+static void exec_ws_destroy(struct exec_queue *q)
+{
+    int cpu;
+
+    for_each_possible_cpu(cpu)
+    {
+        struct exec_ws_rq *rq = per_cpu_ptr(q->ws, cpu);
+        if (rq->thread)
+            kthread_stop(rq->thread);
+        rq->thread = NULL;
+    }
+    free_percpu(q->ws);
+    q->ws = NULL;
+}
+
+struct exec_backend_ops
+{
+    int (*create)(struct exec_queue *q);
+    void (*queue)(struct exec_queue *q, int cpu, struct client_work *cw);
+    void (*destroy)(struct exec_queue *q);
+};
+
+static const struct exec_backend_ops exec_backends[] = {
+    [EXEC_CMWQ] = {exec_cmwq_create, exec_cmwq_queue, exec_cmwq_destroy},
+    [EXEC_KTHREAD_WORKER] = {exec_kworker_create, exec_kworker_queue, exec_kworker_destroy},
+    [EXEC_PERCPU_KTHREAD] = {exec_percpu_create, exec_percpu_queue, exec_percpu_destroy},
+    [EXEC_WORK_STEALING] = {exec_ws_create, exec_ws_queue, exec_ws_destroy},
+};
+
+struct exec_queue *exec_queue_get(const char *name)
+{
+    struct exec_queue *q;
+    int ret;
+
+    for (int i = 0; i < nr_exec_queues; i++)
+        if (strcmp(exec_queues[i].name, name) == 0)
+            return &exec_queues[i];
+
+    if (unlikely(nr_exec_queues == EXEC_MAX_QUEUES))
+    {
+        pr_err("%s: too many stage queues (max %d)\n", THIS_MODULE->name, EXEC_MAX_QUEUES);
+        return NULL;
+    }
+    if (unlikely(executor < 0 || executor >= EXEC_BACKEND_COUNT))
+    {
+        pr_err("%s: Invalid executor %d\n", THIS_MODULE->name, executor);
+        return NULL;
+    }
+
+    q = &exec_queues[nr_exec_queues];
+    memset(q, 0, sizeof(*q));
+    strscpy(q->name, name, EXEC_NAME_LEN);
+    q->backend = executor;
+
+    ret = exec_backends[q->backend].create(q);
+    if (unlikely(ret < 0))
+    {
+        pr_err("%s: Failed to create %s queue %s: %d\n", THIS_MODULE->name, exec_backend_names[q->backend], name,
+               ret);
+        return NULL;
+    }
+
+    nr_exec_queues++;
+    return q;
+}
+
+void exec_queue_work(struct exec_queue *q, int cpu, struct client_work *cw)
+{
+    cw->exec_q = q;
+    cw->exec_queued_at = ktime_get_ns();
+    atomic64_inc(&q->queued);
+    atomic_inc(&exec_pending);
+    exec_backends[q->backend].queue(q, cpu, cw);
+}
+
+void exec_queues_free(void)
+{
+    // a queue drained by its destroy could otherwise still queue successors
+    // on a queue destroyed before it, whatever the order of the stages
+    wait_var_event(&exec_pending, !atomic_read(&exec_pending));
+    for (int i = 0; i < nr_exec_queues; i++)
+        exec_backends[exec_queues[i].backend].destroy(&exec_queues[i]);
+    nr_exec_queues = 0;
+}
+
+static int exec_stats_show(struct seq_file *m, void *v)
+{
+    seq_printf(m, "executor=%s\n",
+               executor >= 0 && executor < EXEC_BACKEND_COUNT ? exec_backend_names[executor] : "invalid");
+    for (int i = 0; i < nr_exec_queues; i++)
+    {
+        struct exec_queue *q = &exec_queues[i];
+        s64 executed = atomic64_read(&q->executed);
+
+        seq_printf(m, "%s backend=%s queued=%lld urgent=%lld executed=%lld enqueue_to_exec_ns_avg=%lld\n", q->name,
+                   exec_backend_names[q->backend], atomic64_read(&q->queued), atomic64_read(&q->urgent), executed,
+                   executed ? div64_s64(atomic64_read(&q->wait_ns), executed) : 0);
+        if (q->backend != EXEC_WORK_STEALING)
+            continue;
+
+        u64 stolen = 0;
+        int cpu;
+        for_each_online_cpu(cpu)
+        {
+            struct exec_ws_rq *rq = per_cpu_ptr(q->ws, cpu);
+            if (!rq->thread)
+                continue;
+            seq_printf(m, "  cpu%d len=%d max_len=%d executed=%llu stolen=%llu\n", cpu, READ_ONCE(rq->len),
+                       READ_ONCE(rq->max_len), READ_ONCE(rq->executed), READ_ONCE(rq->stolen));
+            stolen += READ_ONCE(rq->stolen);
+        }
+        seq_printf(m, "  steals=%llu steal_failed=%lld\n", stolen, atomic64_read(&q->steal_failed));
+    }
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(exec_stats);
+
+void exec_stats_init(void) { kserver_stats_create_file("executor", &exec_stats_fops); }
@@ -0,0 +1,37 @@
+#pragma once
+#include <linux/types.h>
+
+#define EXEC_MAX_QUEUES 16
+#define EXEC_NAME_LEN 32
+
+struct client_work;
+struct exec_queue;
+
+enum exec_backend
+{
+    EXEC_CMWQ,           // workqueue created by kserver_alloc_workqueue (see wq_attrs.h)
+    EXEC_KTHREAD_WORKER, // one kthread_worker per stage
+    EXEC_PERCPU_KTHREAD, // one kthread pinned per online CPU per stage, with its own run queue
+    EXEC_WORK_STEALING,  // same with deques, idle threads steal from busy peers
+    EXEC_BACKEND_COUNT,
+};
+
+/*
+ * exec_queue_get - Find the stage queue called name, or create it with the backend of the executor parameter
+ * @return the queue or NULL on failure.
+ */
+struct exec_queue *exec_queue_get(const char *name);
+
+/*
+ * exec_queue_work - Run client_work_exec(cw) asynchronously on q
+ * @cpu: CPU to run on (see placement.h) or WORK_CPU_UNBOUND, ignored by the kthread_worker backend
+ */
+void exec_queue_work(struct exec_queue *q, int cpu, struct client_work *cw);
+
+/*
+ * exec_queues_free - Wait for every queue to be idle, then destroy them. Nothing may queue a client_work from outside
+ * the queues anymore (clients_stop).
+ */
+void exec_queues_free(void);
+
+void exec_stats_init(void);
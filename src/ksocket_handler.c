@@ -10,12 +10,222 @@
 #include <net/sock.h>
 
 #include "ksocket_handler.h"
+#include "stats.h"
 #include <linux/errno.h>
 #include <linux/in.h>
 #include <linux/inet.h>
 #include <linux/kthread.h>
 #include <linux/sched.h>
 #include <linux/signal.h>
+#include <linux/uio.h>
+
+static unsigned int sock_timeout_ms = 1000;
+module_param(sock_timeout_ms, uint, 0644);
+MODULE_PARM_DESC(sock_timeout_ms, "Send and receive timeout of the connected sockets, 0 to block forever "
+                                  "(default: 1000)");
+
+static unsigned int connect_timeout_ms = 1000;
+module_param(connect_timeout_ms, uint, 0644);
+MODULE_PARM_DESC(connect_timeout_ms, "Timeout of connect_lsocket_addr, 0 to block forever (default: 1000)");
+
+static atomic64_t connect_timeouts = ATOMIC64_INIT(0);
+
+static long ksocket_timeo(unsigned int ms) { return ms ? max_t(long, msecs_to_jiffies(ms), 1) : MAX_SCHEDULE_TIMEOUT; }
+
+void ksocket_set_timeouts(struct socket *sock)
+{
+    long timeo = ksocket_timeo(READ_ONCE(sock_timeout_ms));
+
+    WRITE_ONCE(sock->sk->sk_sndtimeo, timeo);
+    WRITE_ONCE(sock->sk->sk_rcvtimeo, timeo);
+}
+
+struct ksocket_vstats
+{
+    atomic64_t calls;
+    atomic64_t segments;
+    atomic64_t syscalls; // more than calls when transfers were partial
+    atomic64_t bytes;
+};
+
+static struct ksocket_vstats writev_stats;
+static struct ksocket_vstats readv_stats;
+
+static size_t ksocket_vec_len(struct kvec *vec, size_t nr_segs)
+{
+    size_t len = 0;
+    for (size_t i = 0; i < nr_segs; i++)
+        len += vec[i].iov_len;
+    return len;
+}
+
+/*
+ * Skip the first done bytes of the segments, returns the number of segments
+ * fully consumed, the first remaining one is adjusted in place
+ */
+static size_t ksocket_vec_advance(struct kvec *vec, size_t nr_segs, size_t done)
+{
+    size_t i = 0;
+    while (i < nr_segs && done >= vec[i].iov_len)
+    {
+        done -= vec[i].iov_len;
+        i++;
+    }
+    if (i < nr_segs && done)
+    {
+        vec[i].iov_base += done;
+        vec[i].iov_len -= done;
+    }
+    return i;
+}
+
+int ksocket_writev(struct ksocket_vhandler handler)
+{
+    struct kvec *vec = handler.vec;
+    size_t nr_segs = handler.nr_segs;
+    size_t remaining = ksocket_vec_len(vec, nr_segs);
+    int total = 0;
+
+    atomic64_inc(&writev_stats.calls);
+    atomic64_add(nr_segs, &writev_stats.segments);
+
+    while (remaining)
+    {
+        struct msghdr msg = {.msg_flags = handler.flags};
+        int ret = kernel_sendmsg(handler.sock, &msg, vec, nr_segs, remaining);
+        atomic64_inc(&writev_stats.syscalls);
+        if (unlikely(ret < 0))
+        {
+            pr_err("%s: kernel_sendmsg failed: %d\n", THIS_MODULE->name, ret);
+            return ret;
+        }
+
+        total += ret;
+        remaining -= ret;
+        size_t consumed = ksocket_vec_advance(vec, nr_segs, ret);
+        vec += consumed;
+        nr_segs -= consumed;
+    }
+
+    atomic64_add(total, &writev_stats.bytes);
+    return total;
+}
+
+int ksocket_readv(struct ksocket_vhandler handler)
+{
+    struct kvec *vec = handler.vec;
+    size_t nr_segs = handler.nr_segs;
+    size_t remaining = ksocket_vec_len(vec, nr_segs);
+    int total = 0;
+
+    atomic64_inc(&readv_stats.calls);
+    atomic64_add(nr_segs, &readv_stats.segments);
+
+    while (remaining)
+    {
+        struct msghdr msg = {.msg_flags = handler.flags};
+        int ret = kernel_recvmsg(handler.sock, &msg, vec, nr_segs, remaining, handler.flags);
+        atomic64_inc(&readv_stats.syscalls);
+        if (ret <= 0)
+        {
+            if (unlikely(ret < 0 && ret != -EAGAIN))
+                pr_err("%s: kernel_recvmsg failed: %d\n", THIS_MODULE->name, ret);
+            // report what was read before the error/close
+            if (total)
+                break;
+            return ret;
+        }
+
+        total += ret;
+        remaining -= ret;
+        // non blocking: the socket gave what it had
+        if (handler.flags & MSG_DONTWAIT)
+            break;
+        size_t consumed = ksocket_vec_advance(vec, nr_segs, ret);
+        vec += consumed;
+        nr_segs -= consumed;
+    }
+
+    atomic64_add(total, &readv_stats.bytes);
+    return total;
+}
+
+static atomic64_t sendpages_calls = ATOMIC64_INIT(0);
+static atomic64_t sendpages_bytes = ATOMIC64_INIT(0);
+
+#ifdef MSG_SPLICE_PAGES
+int ksocket_sendpages(struct socket *sock, const struct bio_vec *bvec, unsigned int nr_segs, size_t len)
+{
+    struct msghdr msg = {.msg_flags = MSG_SPLICE_PAGES};
+    int total = 0;
+
+    atomic64_inc(&sendpages_calls);
+    // the iterator is private to this call, bvec itself is only read
+    iov_iter_bvec(&msg.msg_iter, ITER_SOURCE, bvec, nr_segs, len);
+    while (msg_data_left(&msg))
+    {
+        int ret = sock_sendmsg(sock, &msg);
+        if (unlikely(ret < 0))
+        {
+            pr_err("%s: sock_sendmsg (splice) failed: %d\n", THIS_MODULE->name, ret);
+            return ret;
+        }
+        total += ret;
+    }
+
+    atomic64_add(total, &sendpages_bytes);
+    return total;
+}
+#else
+int ksocket_sendpages(struct socket *sock, const struct bio_vec *bvec, unsigned int nr_segs, size_t len)
+{
+    int total = 0;
+
+    atomic64_inc(&sendpages_calls);
+    for (unsigned int i = 0; i < nr_segs; i++)
+    {
+        size_t off = 0;
+        while (off < bvec[i].bv_len)
+        {
+            int flags = (i + 1 < nr_segs) ? MSG_MORE : 0;
+            int ret = kernel_sendpage(sock, bvec[i].bv_page, bvec[i].bv_offset + off, bvec[i].bv_len - off, flags);
+            if (unlikely(ret < 0))
+            {
+                pr_err("%s: kernel_sendpage failed: %d\n", THIS_MODULE->name, ret);
+                return ret;
+            }
+            off += ret;
+            total += ret;
+        }
+    }
+
+    atomic64_add(total, &sendpages_bytes);
+    return total;
+}
+#endif
+
+static void ksocket_vstats_show(struct seq_file *m, const char *name, struct ksocket_vstats *stats)
+{
+    u64 calls = atomic64_read(&stats->calls);
+
+    seq_printf(m, "%s calls=%llu segments=%llu syscalls=%llu bytes=%llu segments_per_call_x100=%llu\n", name, calls,
+               atomic64_read(&stats->segments), atomic64_read(&stats->syscalls), atomic64_read(&stats->bytes),
+               calls ? div64_u64(atomic64_read(&stats->segments) * 100, calls) : 0);
+}
+
+static int ksocket_stats_show(struct seq_file *m, void *v)
+{
+    ksocket_vstats_show(m, "writev", &writev_stats);
+    ksocket_vstats_show(m, "readv", &readv_stats);
+    seq_printf(m, "sendpages calls=%llu bytes=%llu\n", atomic64_read(&sendpages_calls),
+               atomic64_read(&sendpages_bytes));
+    seq_printf(m, "sock_timeout_ms=%u connect_timeout_ms=%u connect_timeouts=%llu\n", READ_ONCE(sock_timeout_ms),
+               READ_ONCE(connect_timeout_ms), atomic64_read(&connect_timeouts));
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(ksocket_stats);
+
+void ksocket_stats_init(void) { kserver_stats_create_file("ksocket", &ksocket_stats_fops); }
 
 int ksocket_read(struct ksocket_handler handler)
 {
@@ -30,9 +240,10 @@ int ksocket_read(struct ksocket_handler handler)
 
     vec.iov_base = handler.buf;
     vec.iov_len = handler.len;
+    msg.msg_flags = handler.flags;
 
     ret = kernel_recvmsg(sock, &msg, &vec, 1, handler.len, msg.msg_flags);
-    if (unlikely(ret < 0))
+    if (unlikely(ret < 0 && ret != -EAGAIN))
         pr_err("%s: kernel_recvmsg failed: %d\n", THIS_MODULE->name, ret);
     return ret;
 }
@@ -48,6 +259,7 @@ int ksocket_write(struct ksocket_handler handler)
 
     vec.iov_base = handler.buf;
     vec.iov_len = len;
+    msg.msg_flags = handler.flags;
 
     ret = kernel_sendmsg(sock, &msg, &vec, 1, len);
     if (unlikely(ret < 0))
@@ -253,12 +465,20 @@ int connect_lsocket_addr(struct socket **result, const char *ip, int port)
         goto err_connect;
     }
 
+    // a blocking connect waits at most sk_sndtimeo, then gives up with -EINPROGRESS
+    sock->sk->sk_sndtimeo = ksocket_timeo(READ_ONCE(connect_timeout_ms));
     error = kernel_connect(sock, (struct sockaddr *)&addr, sizeof(addr), 0);
+    if (error == -EINPROGRESS)
+    {
+        atomic64_inc(&connect_timeouts);
+        error = -ETIMEDOUT;
+    }
     if (unlikely(error < 0))
     {
         pr_err("%s: kernel_connect failed for %s:%d: %d\n", THIS_MODULE->name, ip, port, error);
         goto err_connect;
     }
+    ksocket_set_timeouts(sock);
 
     // pr_info("%s: connected to %s:%d\n", THIS_MODULE->name, ip, port);
     *result = sock;
@@ -267,4 +487,50 @@ int connect_lsocket_addr(struct socket **result, const char *ip, int port)
 err_connect:
     sock_release(sock);
     return error;
+}
+
+/*
+ * Parse an "IP:PORT" string, ip must be able to hold ip_size bytes
+ */
+int ksocket_parse_address(const char *addr_str, char *ip, size_t ip_size, int *port)
+{
+    char *colon_pos;
+    int ip_len;
+
+    if (unlikely(!addr_str || !ip || !port))
+    {
+        pr_err("%s: Invalid address or address structure is NULL\n", THIS_MODULE->name);
+        return -EINVAL;
+    }
+
+    colon_pos = strchr(addr_str, ':');
+    if (unlikely(!colon_pos))
+    {
+        pr_err("%s: Invalid address format: %s (expected IP:PORT)\n", THIS_MODULE->name, addr_str);
+        return -EINVAL;
+    }
+
+    ip_len = colon_pos - addr_str;
+    if (unlikely(ip_len >= ip_size))
+    {
+        pr_err("%s: IP address too long: %s\n", THIS_MODULE->name, addr_str);
+        return -EINVAL;
+    }
+
+    strncpy(ip, addr_str, ip_len);
+    ip[ip_len] = '\0';
+
+    if (unlikely(kstrtoint(colon_pos + 1, 10, port) < 0))
+    {
+        pr_err("%s: Invalid port number: %s\n", THIS_MODULE->name, colon_pos + 1);
+        return -EINVAL;
+    }
+
+    if (unlikely(*port < 0 || *port > 65535))
+    {
+        pr_err("%s: Port number out of range: %d\n", THIS_MODULE->name, *port);
+        return -EINVAL;
+    }
+
+    return 0;
 }
\ No newline at end of file
@@ -1,4 +1,6 @@
 #pragma once
+#include <linux/bvec.h>
+#include <linux/errno.h>
 #include <linux/types.h>
 
 struct ksocket_handler
@@ -6,11 +8,55 @@ struct ksocket_handler
     struct socket *sock;
     void *buf;
     int len;
+    int flags; // MSG_* flags, e.g. MSG_DONTWAIT
+};
+
+/*
+ * Vectored variant of ksocket_handler, vec is advanced in place when a
+ * transfer is partial so the caller must not reuse it afterwards
+ */
+struct ksocket_vhandler
+{
+    struct socket *sock;
+    struct kvec *vec;
+    size_t nr_segs;
+    int flags; // MSG_* flags, e.g. MSG_DONTWAIT
 };
 
 int ksocket_write(struct ksocket_handler handler);
 int ksocket_read(struct ksocket_handler handler);
+/*
+ * ksocket_writev - Send every segment, partial sends are resumed internally
+ * @return number of bytes sent (the sum of the segments) or negative error code.
+ */
+int ksocket_writev(struct ksocket_vhandler handler);
+/*
+ * ksocket_readv - Fill the segments in order. A blocking read loops until every segment is full or the peer
+ * closed, with MSG_DONTWAIT a single recv is done and returns what the socket had.
+ * @return number of bytes read, 0 when the peer closed, negative error code on failure (-EAGAIN if nothing to read).
+ */
+int ksocket_readv(struct ksocket_vhandler handler);
+/*
+ * ksocket_sendpages - Send len bytes described by bvec without copying them, the network stack takes its own
+ * reference on the pages (MSG_SPLICE_PAGES, kernel_sendpage() before 6.5). Pages must not be modified afterwards.
+ * @return number of bytes sent or negative error code.
+ */
+int ksocket_sendpages(struct socket *sock, const struct bio_vec *bvec, unsigned int nr_segs, size_t len);
+/*
+ * ksocket_stats_init - Expose ksocket_writev/ksocket_readv counters in debugfs
+ */
+void ksocket_stats_init(void);
+/*
+ * ksocket_set_timeouts - Bound the blocking sends and receives of sock to sock_timeout_ms, a timed out call
+ * returns -EAGAIN. connect_lsocket_addr() sets them on the sockets it returns.
+ */
+void ksocket_set_timeouts(struct socket *sock);
+/*
+ * ksocket_timed_out - Whether err, returned by a blocking call on a socket with timeouts, means it timed out
+ */
+static inline bool ksocket_timed_out(int err) { return err == -EAGAIN || err == -ETIMEDOUT; }
 int open_lsocket(struct socket **socket, int port);
 int open_lsocket_addr(struct socket **result, const char *ip, int port);
 int connect_lsocket_addr(struct socket **result, const char *ip, int port);
-int close_lsocket(struct socket *socket);
\ No newline at end of file
+int close_lsocket(struct socket *socket);
+int ksocket_parse_address(const char *addr_str, char *ip, size_t ip_size, int *port);
\ No newline at end of file
@@ -17,17 +17,25 @@
 #include <linux/signal.h>
 #include <linux/version.h>
 
+#include "acceptor.h"
+#include "admission.h"
+#include "client.h"
+#include "executor.h"
 #include "ksocket_handler.h"
+#include "page_buf.h"
+#include "placement.h"
+#include "predictor.h"
+#include "stats.h"
 
 #include "operations.h"
 #include "scenario.h"
 #include "task.h"
+#include "wq_attrs.h"
 
 MODULE_DESCRIPTION("My kernel module");
 MODULE_AUTHOR("yanovskyy");
 MODULE_LICENSE("GPL");
 
-#define BUF_SIZE 4096
 #define MAX_LISTEN_SOCKETS 10
 #define MAX_ADDR_STR_LEN 256
 
@@ -41,157 +49,104 @@ static int kserver_port = 12345;
 module_param(kserver_port, int, 0644);
 MODULE_PARM_DESC(kserver_port, "Port number for the kernel server (default: 12345)");
 
+static int accept_mode = ACCEPT_SINGLE;
+module_param(accept_mode, int, 0444);
+MODULE_PARM_DESC(accept_mode, "Acceptor mode (0: single listener, 1: one SO_REUSEPORT listener per CPU on kserver_port, "
+                              "2: one listener per address of accept_addresses)");
+
+static char *accept_addresses = "0.0.0.0:12345";
+module_param(accept_addresses, charp, 0444);
+MODULE_PARM_DESC(accept_addresses, "Comma-separated list of IP:port the server listens on when accept_mode=2");
+
 static int scenario = -1;
 module_param(scenario, int, 0644);
 MODULE_PARM_DESC(scenario, "Scenario to run (0: CPU, 1: MOM)");
 
-static struct workqueue_struct *kserver_clients_read;
-
-static struct task_struct *kserver_thread;
-typedef struct _client
-{
-    struct list_head list;             // For linked list
-    struct socket *sock;               // Socket for communication
-    struct work_struct client_context; // representing the client context
-} client;
-
-struct socket *listen_sock;
-
-LIST_HEAD(lclients);
-LIST_HEAD(lclients_works);
-DEFINE_SPINLOCK(lclients_works_lock);
+static char *dag = "";
+module_param(dag, charp, 0444);
+MODULE_PARM_DESC(dag, "Task graph replacing the prebuilt one of the scenario, e.g. "
+                      "'a=cpu(100)@wq_a;b=disk(1)@wq_b;c=ack@wq_c;a>b;b>c' (see dag.h)");
 
-static void client_handler(struct work_struct *work)
+/*
+ * Called from the client rx worker with the frames parsed from one recv
+ */
+static int kserver_on_frames(client *cl, struct client_frame *frames, int nr_frames)
 {
-    client *cl = container_of(work, client, client_context);
-
-    void *buf;
-    buf = kmalloc(BUF_SIZE, GFP_KERNEL);
-    if (unlikely(!buf))
+    for (int i = 0; i < nr_frames; i++)
     {
-        pr_err("%s: Failed to allocate memory for buffer\n", THIS_MODULE->name);
-        goto clean;
-    }
-    spinlock_t sp = __SPIN_LOCK_UNLOCKED(sp);
+        int res = 0;
 
-    uint32_t len_recv = 0;
-    // TODO: this is in a case where workqueue should be created with flag
-    // WQ_UNBOUND, one workaround is put back self to the workqueue
-    // after ksocket_read has been done
-    for (;;)
-    {
-        int ret = ksocket_read((struct ksocket_handler){
-            .sock = cl->sock,
-            .buf = &len_recv,
-            .len = sizeof(len_recv),
-        });
-        if (ret < 0)
-        {
-            pr_err("%s: ksocket_read failed: %d\n", THIS_MODULE->name, ret);
-            goto clean;
-        }
-        if (ret == 0)
-        {
-            // pr_info("%s: Connection closed by peer\n", THIS_MODULE->name);
-            goto clean;
-        }
-        ret = ksocket_read((struct ksocket_handler){
-            .sock = cl->sock,
-            .buf = buf,
-            .len = len_recv,
-        });
-        if (ret < 0)
+        // over the limits the client gets an immediate reject instead of
+        // queueing more work in the graph
+        if (admission_try_enter(cl) < 0)
         {
-            pr_err("%s: ksocket_read failed: %d\n", THIS_MODULE->name, ret);
-            goto clean;
+            admission_reject(cl);
+            continue;
         }
-        if (ret == 0)
+
+        struct client_request *req = client_request_alloc(cl);
+        if (unlikely(!req))
         {
-            // pr_info("%s: Connection closed by peer\n", THIS_MODULE->name);
-            goto clean;
+            admission_exit(cl);
+            return -ENOMEM;
         }
 
-        int res = 0;
         switch (scenario)
         {
         case ONLY_CPU:
-            res = only_cpu_start();
+            res = only_cpu_start(req);
             break;
         case MOM_PUBLISH:
-            res = mom_publish_start(cl->sock, &sp, MOM_PUBLISH_ACK_FLAG, MOM_PUBLISH_ACK_FLAG_LEN);
+            res = mom_publish_start(req, frames[i].buf, frames[i].len);
             break;
         default:
             pr_err("%s: Invalid scenario selected\n", THIS_MODULE->name);
-            goto clean;
+            res = -EINVAL;
+            break;
         }
 
         if (unlikely(res < 0))
         {
             pr_err("%s: Failed to start scenario: %d\n", THIS_MODULE->name, res);
-            goto clean;
+            client_request_complete(req);
+            return res;
         }
 
-        // pr_info("%s: Packet : %s\n", THIS_MODULE->name, buf);
+        // pr_info("%s: Packet : %.*s\n", THIS_MODULE->name, frames[i].len, (char *)frames[i].buf);
     }
-
-clean:
-    kernel_sock_shutdown(cl->sock, SHUT_RDWR);
-    if (buf)
-        kfree(buf);
+    return 0;
 }
 
 /*
- * This function creates a client structure, appends
- * it to clients list and return a work_struct
+ * Called by the acceptors (see acceptor.c) for every accepted connection
  */
-static inline struct work_struct *create_client(struct socket *sock)
+static int kserver_on_accept(struct socket *sock)
 {
-    client *cl = kmalloc(sizeof(client), GFP_KERNEL);
-    if (unlikely(!cl))
-    {
-        pr_err("%s: Failed to allocate memory for client\n", THIS_MODULE->name);
-        return NULL;
-    }
-
-    cl->sock = sock;
-    INIT_WORK(&cl->client_context, client_handler);
-    list_add_tail(&cl->list, &lclients);
-
-    return &cl->client_context;
+    int res = client_create(sock);
+    if (unlikely(res < 0))
+        pr_err("%s: Failed to create client: %d\n", THIS_MODULE->name, res);
+    return res;
 }
 
-static int kserver_daemon(void *data)
+/*
+ * Free the task graph of the scenario, its stage queues (exec_queues_free) and for MOM the subscriber pool
+ * (conn_pool_free)
+ */
+static void kserver_scenario_free(void)
 {
-    (void)data;
-    struct socket *sock;
-    struct work_struct *client_read_work;
-
-    allow_signal(SIGKILL);
-    allow_signal(SIGTERM);
-
-    while (!kthread_should_stop())
+    switch (scenario)
     {
-        int error = kernel_accept(listen_sock, &sock, 0);
-        if (unlikely(error < 0))
-        {
-            pr_err("%s: kernel_accept failed: %d\n", THIS_MODULE->name, error);
-            continue;
-        }
-
-        client_read_work = create_client(sock);
-        if (unlikely(!client_read_work))
-        {
-            pr_err("%s: Failed to create client work\n", THIS_MODULE->name);
-            kernel_sock_shutdown(sock, SHUT_RDWR);
-            sock_release(sock);
-            continue;
-        }
-
-        queue_work(kserver_clients_read, client_read_work);
+    case ONLY_CPU:
+        only_cpu_free();
+        break;
+    case MOM_PUBLISH:
+        mom_publish_free();
+        break;
+    default:
+        pr_err("%s: oops you shouldn't be here\n", THIS_MODULE->name);
+        break;
     }
-
-    pr_info("%s: kserver_daemon stopped\n", THIS_MODULE->name);
-    return 0;
+    op_cpu_matrix_cache_free();
 }
 
 static int __init kserver_init(void)
@@ -205,13 +160,26 @@ static int __init kserver_init(void)
     }
 
     pr_info("%s: Running scenario: %s\n", THIS_MODULE->name, get_scenario_description(scenario));
+    kserver_stats_init();
+    ksocket_stats_init();
+    page_buf_stats_init();
+    admission_stats_init();
+    task_stats_init();
+    wq_attrs_stats_init();
+    placement_stats_init();
+    exec_stats_init();
+    predictor_stats_init();
+
+    const char *dag_spec = *dag ? dag : get_scenario_dag(scenario);
+    pr_info("%s: Task graph: %s\n", THIS_MODULE->name, dag_spec);
+
     switch (scenario)
     {
     case ONLY_CPU:
-        res = only_cpu_init();
+        res = only_cpu_init(dag_spec);
         break;
     case MOM_PUBLISH:
-        res = mom_publish_init(listen_addresses);
+        res = mom_publish_init(listen_addresses, dag_spec);
         break;
     default:
         pr_err("%s: Invalid scenario selected\n", THIS_MODULE->name);
@@ -220,81 +188,42 @@ static int __init kserver_init(void)
 
     if (unlikely(res < 0))
     {
-        pr_err("%s: Failed to initialize MOM publish\n", THIS_MODULE->name);
-        return -ENOMEM;
-    }
-
-    res = open_lsocket(&listen_sock, kserver_port);
-    if (unlikely(res < 0))
-    {
-        pr_err("%s: Failed to open socket: %d\n", THIS_MODULE->name, res);
+        pr_err("%s: Failed to initialize scenario: %d\n", THIS_MODULE->name, res);
+        kserver_stats_free();
         return res;
     }
 
-    // Note for the future: have a check on flags, espcially
-    // WQ_HIGHPRI, WQ_CPU_INTENSIVE
-    // https://www.kernel.org/doc/html/next/core-api/workqueue.html#flags
-    kserver_clients_read = alloc_workqueue("kserver_clients_read", 0, 0);
-    if (unlikely(!kserver_clients_read))
-    {
-        pr_err("%s: Failed to create workqueue\n", THIS_MODULE->name);
-        return -ENOMEM;
-    }
+    res = clients_init(kserver_on_frames);
+    if (unlikely(res < 0))
+        goto err_scenario;
 
-    kserver_thread = kthread_run(kserver_daemon, NULL, THIS_MODULE->name);
-    if (unlikely(IS_ERR(kserver_thread)))
+    res = acceptors_start(accept_mode, kserver_port, accept_addresses, kserver_on_accept);
+    if (unlikely(res < 0))
     {
-        pr_err("%s: Failed to create kernel thread\n", THIS_MODULE->name);
-        res = close_lsocket(listen_sock);
-        if (unlikely(res < 0))
-            pr_err("%s: Failed to close socket: %d\n", THIS_MODULE->name, res);
-
-        return PTR_ERR(kserver_thread);
+        pr_err("%s: Failed to start acceptors: %d\n", THIS_MODULE->name, res);
+        clients_stop();
+        clients_free();
+        goto err_scenario;
     }
     return 0;
-}
 
-static void free_client_list(void)
-{
-    client *cl, *tmp;
-    list_for_each_entry_safe(cl, tmp, &lclients, list)
-    {
-        list_del(&cl->list);
-        kernel_sock_shutdown(cl->sock, SHUT_RDWR);
-        sock_release(cl->sock);
-        kfree(cl);
-    }
+err_scenario:
+    // the stage queues may be kthreads running module text
+    kserver_scenario_free();
+    kserver_stats_free();
+    return res;
 }
 
 static void __exit kserver_exit(void)
 {
     pr_info("%s: Server stopped.\n", THIS_MODULE->name);
 
-    if (kserver_thread)
-        kthread_stop(kserver_thread);
-
-    close_lsocket(listen_sock);
-
-    if (kserver_clients_read)
-    {
-        flush_workqueue(kserver_clients_read);
-        destroy_workqueue(kserver_clients_read);
-    }
-
-    switch (scenario)
-    {
-    case ONLY_CPU:
-        only_cpu_free();
-        break;
-    case MOM_PUBLISH:
-        mom_publish_free();
-        break;
-    default:
-        pr_err("%s: oops you shouldn't be here\n", THIS_MODULE->name);
-        break;
-    }
+    acceptors_stop();
+    clients_stop();
 
-    free_client_list();
+    kserver_scenario_free();
+    clients_free();
+    kserver_stats_free();
 
     pr_info("%s: bye bye\n", THIS_MODULE->name);
 }
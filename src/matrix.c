@@ -0,0 +1,33 @@
+#include <linux/minmax.h>
+#include <linux/string.h>
+
+#include "matrix.h"
+
+void matrix_mul(const int *a, const int *b, int *result, int size)
+{
+    memset(result, 0, (size_t)size * size * sizeof(int));
+
+    for (int ii = 0; ii < size; ii += MATRIX_TILE)
+    {
+        int i_end = min(ii + MATRIX_TILE, size);
+        for (int kk = 0; kk < size; kk += MATRIX_TILE)
+        {
+            int k_end = min(kk + MATRIX_TILE, size);
+            for (int jj = 0; jj < size; jj += MATRIX_TILE)
+            {
+                int j_end = min(jj + MATRIX_TILE, size);
+                for (int i = ii; i < i_end; i++)
+                {
+                    int *r = result + (size_t)i * size;
+                    for (int k = kk; k < k_end; k++)
+                    {
+                        const int aik = a[(size_t)i * size + k];
+                        const int *bk = b + (size_t)k * size;
+                        for (int j = jj; j < j_end; j++)
+                            r[j] += aik * bk[j];
+                    }
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+// side of the square blocks of matrix_mul, 3 blocks of ints fit in a 48K L1D
+#define MATRIX_TILE 64
+
+/*
+ * matrix_mul - result = a * b for size x size row-major matrices stored contiguously, cache-blocked i-k-j: the
+ * innermost loop walks rows of b and result so every access is sequential. result must not overlap a or b.
+ */
+void matrix_mul(const int *a, const int *b, int *result, int size);
@@ -8,7 +8,12 @@
 #include <linux/init.h>
 #include <linux/kernel.h>
 #include <linux/list.h>
+#include <linux/math64.h>
+#include <linux/mm.h>
 #include <linux/module.h>
+#include <linux/slab.h>
+
+#include "matrix.h"
 
 MODULE_DESCRIPTION("My kernel module");
 MODULE_AUTHOR("yanovskyy");
@@ -22,6 +27,11 @@ static int repeat_operations = 1;
 module_param(repeat_operations, int, 0644);
 MODULE_PARM_DESC(repeat_operations, "number of times to repeat matrix operations");
 
+static int bench_multiplication = 0;
+module_param(bench_multiplication, int, 0644);
+MODULE_PARM_DESC(bench_multiplication, "also compare the multiplication of the cpu op before (row arrays allocated "
+                                       "per call, i-j-k) and after (reused contiguous buffer, tiled i-k-j)");
+
 static int *create_matrix(int size)
 {
     pr_info("Creating matrix of size %d\n", size);
@@ -50,6 +60,124 @@ noinline void perform_matrix_operations(int *a, int *b, int *result, int size_ma
             result[i * size_matrix + j] = a[i * size_matrix + j] + b[i * size_matrix + j];
 }
 
+// former op_cpu_matrix_multiplication: 3 + 3 * size allocations per call and
+// b walked down its columns
+static int **alloc_rows(int size)
+{
+    int **m = kcalloc(size, sizeof(int *), GFP_KERNEL);
+    if (!m)
+        return NULL;
+
+    for (int i = 0; i < size; i++)
+    {
+        m[i] = kzalloc(size * sizeof(int), GFP_KERNEL);
+        if (!m[i])
+        {
+            while (i--)
+                kfree(m[i]);
+            kfree(m);
+            return NULL;
+        }
+    }
+    return m;
+}
+
+static void free_rows(int **m, int size)
+{
+    if (!m)
+        return;
+
+    for (int i = 0; i < size; i++)
+        kfree(m[i]);
+    kfree(m);
+}
+
+static noinline int matrix_mul_rows(int size)
+{
+    int **a = alloc_rows(size);
+    int **b = alloc_rows(size);
+    int **result = alloc_rows(size);
+    int res = -ENOMEM;
+
+    if (!a || !b || !result)
+        goto out;
+
+    for (int i = 0; i < size; i++)
+    {
+        for (int j = 0; j < size; j++)
+        {
+            result[i][j] = 0;
+            for (int k = 0; k < size; k++)
+                result[i][j] += a[i][k] * b[k][j];
+        }
+    }
+    res = 0;
+out:
+    free_rows(a, size);
+    free_rows(b, size);
+    free_rows(result, size);
+    return res;
+}
+
+static void report_multiplication(const char *name, s64 elapsed_ns, int size)
+{
+    u64 flops = 2ULL * size * size * size * repeat_operations;
+
+    pr_info("%s: %s: %d multiplications %dx%d in %lld ns, %lld ns each, %llu MFLOP/s\n", THIS_MODULE->name, name,
+            repeat_operations, size, size, elapsed_ns, div_s64(elapsed_ns, repeat_operations),
+            elapsed_ns ? div64_u64(flops * 1000, elapsed_ns) : 0);
+}
+
+/*
+ * Multiplication throughput of the cpu op, before and after the contiguous
+ * buffer cache and the tiled kernel
+ */
+static int bench_matrix_multiplication(int size)
+{
+    size_t nr = (size_t)size * size;
+    int *buf;
+    ktime_t t0;
+    s64 rows_ns, tiled_ns;
+
+    t0 = ktime_get();
+    for (int i = 0; i < repeat_operations; i++)
+    {
+        if (matrix_mul_rows(size) < 0)
+        {
+            pr_err("Failed to allocate memory for the row matrices\n");
+            return -ENOMEM;
+        }
+    }
+    rows_ns = ktime_to_ns(ktime_sub(ktime_get(), t0));
+
+    // allocated once, like the per-CPU buffer reused by the op
+    buf = kvcalloc(3 * nr, sizeof(int), GFP_KERNEL);
+    if (!buf)
+    {
+        pr_err("Failed to allocate memory for the contiguous matrices\n");
+        return -ENOMEM;
+    }
+    t0 = ktime_get();
+    for (int i = 0; i < repeat_operations; i++)
+    {
+        memset(buf, 0, 2 * nr * sizeof(int));
+        matrix_mul(buf, buf + nr, buf + 2 * nr, size);
+    }
+    tiled_ns = ktime_to_ns(ktime_sub(ktime_get(), t0));
+    kvfree(buf);
+
+    report_multiplication("rows i-j-k", rows_ns, size);
+    report_multiplication("contiguous tiled i-k-j", tiled_ns, size);
+    if (tiled_ns)
+    {
+        s32 frac;
+        s64 speedup = div_s64_rem(div64_s64(rows_ns * 100, tiled_ns), 100, &frac);
+
+        pr_info("%s: speedup x%lld.%02d\n", THIS_MODULE->name, speedup, frac);
+    }
+    return 0;
+}
+
 static int __init start(void)
 {
     pr_info("%s: Initializing module with matrix size %d\n", THIS_MODULE->name, size_matrix);
@@ -104,6 +232,9 @@ static int __init start(void)
     free_matrix(a, size_matrix);
     free_matrix(b, size_matrix);
     free_matrix(result, size_matrix);
+
+    if (bench_multiplication && repeat_operations > 0)
+        return bench_matrix_multiplication(size_matrix);
     return 0;
 }
 
@@ -1,19 +1,23 @@
 #pragma once
 
+#include "client.h"
 #include "task.h"
 
 #define MOM_PUBLISH_ACK_FLAG "PUBACK"
 #define MOM_PUBLISH_ACK_FLAG_LEN 6
 
 /*
- * mom_publish_init - Initialize internal workqueues for the MOM
+ * mom_publish_init - Compile the MOM task graph, its workqueues are created on the way
+ * @addresses_str: comma-separated IP:PORT of the subscribers notified on each publish
+ * @dag_spec: task graph description, see dag.h
  * @return 0 on success, negative error code on failure.
  */
-int mom_publish_init(char *addresses_str);
+int mom_publish_init(char *addresses_str, const char *dag_spec);
 /*
  * mom_publish_start - Start the MOM publish process
- * @s: socket to use for the publish process
+ * @req: admitted request, the ack is enqueued on the tx queue of req->cl
+ * @payload: published message, copied so it only has to be valid during the call
  */
-int mom_publish_start(struct socket *s, spinlock_t *sp, char *ack_flag_msg, int ack_flag_msg_len);
+int mom_publish_start(struct client_request *req, void *payload, uint32_t payload_len);
 
 void mom_publish_free(void);
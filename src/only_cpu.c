@@ -1,65 +1,41 @@
+#include <linux/err.h>
 #include <linux/module.h>
 #include <linux/workqueue.h>
 
+#include "dag.h"
 #include "only_cpu.h"
 #include "task.h"
 
-struct workqueue_struct *only_cpu_wq;
+static struct dag_template *only_cpu_dag;
 
-int only_cpu_init(void)
+int only_cpu_init(const char *dag_spec)
 {
-    only_cpu_wq = alloc_workqueue("only_cpu_wq", 0, 0);
-    if (unlikely(!only_cpu_wq))
+    only_cpu_dag = dag_template_compile(dag_spec, &(struct dag_env){});
+    if (unlikely(IS_ERR(only_cpu_dag)))
     {
-        pr_err("%s: Failed to create workqueue\n", THIS_MODULE->name);
-        return -ENOMEM;
+        int ret = PTR_ERR(only_cpu_dag);
+        only_cpu_dag = NULL;
+        pr_err("%s: Failed to compile the task graph: %d\n", THIS_MODULE->name, ret);
+        return ret;
     }
 
     return 0;
 }
 
-int only_cpu_start(void)
+int only_cpu_start(struct client_request *req)
 {
-    if (unlikely(!only_cpu_wq))
+    if (unlikely(!only_cpu_dag))
     {
-        pr_err("%s: Workqueue not initialized\n", THIS_MODULE->name);
+        pr_err("%s: Task graph not initialized\n", THIS_MODULE->name);
         return -EINVAL;
     }
 
-    struct client_work *cw = kzalloc(sizeof(struct client_work), GFP_KERNEL);
-    if (unlikely(!cw))
-    {
-        pr_err("%s: Failed to allocate memory for client_work\n", THIS_MODULE->name);
-        return -ENOMEM;
-    }
-
-    *cw = (struct client_work){
-        .t =
-            {
-                .args.cpu_args.args =
-                    {
-                        .matrix_multiplication = {.size = 1000, .a = NULL, .b = NULL, .result = NULL},
-                    },
-            },
-        .total_next_workqueue = 0,
-    };
-    INIT_WORK(&cw->work, w_cpu);
-
-    spin_lock(&lclients_works_lock);
-    list_add(&cw->list, &lclients_works);
-    spin_unlock(&lclients_works_lock);
-
-    queue_work(only_cpu_wq, &cw->work);
-    return 0;
+    return dag_instantiate(only_cpu_dag, req, NULL);
 }
 
 void only_cpu_free(void)
 {
-    if (only_cpu_wq)
-    {
-        flush_workqueue(only_cpu_wq);
-        destroy_workqueue(only_cpu_wq);
-    }
-
-    free_client_work_list();
+    if (only_cpu_dag)
+        dag_template_free(only_cpu_dag);
+    only_cpu_dag = NULL;
 }
@@ -1,7 +1,8 @@
 #pragma once
 
-int only_cpu_init(void);
+int only_cpu_init(const char *dag_spec);
 
-int only_cpu_start(void);
+struct client_request;
+int only_cpu_start(struct client_request *req);
 
 void only_cpu_free(void);
\ No newline at end of file
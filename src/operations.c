@@ -1,5 +1,10 @@
 #include "operations.h"
+#include "client.h"
+#include "conn_pool.h"
 #include "ksocket_handler.h"
+#include "matrix.h"
+#include <linux/mm.h>
+#include <linux/percpu.h>
 #include <linux/slab.h>
 #include <linux/tcp.h>
 
@@ -11,103 +16,76 @@
 #include <linux/module.h>
 #include <linux/syscalls.h>
 
+struct op_matrix_buf
+{
+    size_t nr_ints; // capacity of data
+    int data[];
+};
+
+// last buffer released on the CPU, taken by the next init running there
+static DEFINE_PER_CPU(struct op_matrix_buf *, op_matrix_buf_cache);
+static atomic64_t op_matrix_allocs = ATOMIC64_INIT(0);
+// one client_tx_msg, header and copy of the payload, per queued send
+static atomic64_t op_network_allocs = ATOMIC64_INIT(0);
+
 int op_cpu_matrix_multiplication_init(op_cpu_args_t *args)
 {
     int size = args->args.matrix_multiplication.size;
-    args->args.matrix_multiplication.a = kzalloc(size * sizeof(int *), GFP_KERNEL);
-    if (!args->args.matrix_multiplication.a)
-    {
-        kfree(args);
-        return -1;
-    }
-    args->args.matrix_multiplication.b = kzalloc(size * sizeof(int *), GFP_KERNEL);
-    if (!args->args.matrix_multiplication.b)
-    {
-        kfree(args->args.matrix_multiplication.a);
-        kfree(args);
-        return -1;
-    }
-    args->args.matrix_multiplication.result = kzalloc(size * sizeof(int *), GFP_KERNEL);
-    if (!args->args.matrix_multiplication.result)
-    {
-        kfree(args->args.matrix_multiplication.b);
-        kfree(args->args.matrix_multiplication.a);
-        kfree(args);
-        return -1;
-    }
+    size_t nr_ints = 3 * (size_t)size * size;
+    // the worker may sleep or migrate before the free, the buffer is
+    // owned by the op until then
+    struct op_matrix_buf *buf = this_cpu_xchg(op_matrix_buf_cache, NULL);
 
-    for (int i = 0; i < size; i++)
+    if (!buf || buf->nr_ints < nr_ints)
     {
-        args->args.matrix_multiplication.a[i] = kzalloc(size * sizeof(int), GFP_KERNEL);
-        if (!args->args.matrix_multiplication.a[i])
-        {
-            for (int j = 0; j < i; j++)
-                kfree(args->args.matrix_multiplication.a[j]);
-            kfree(args->args.matrix_multiplication.a);
-            kfree(args->args.matrix_multiplication.b);
-            kfree(args->args.matrix_multiplication.result);
-            kfree(args);
-            return -1;
-        }
-
-        args->args.matrix_multiplication.b[i] = kzalloc(size * sizeof(int), GFP_KERNEL);
-        if (!args->args.matrix_multiplication.b[i])
+        kvfree(buf);
+        buf = kvmalloc(struct_size(buf, data, nr_ints), GFP_KERNEL);
+        if (unlikely(!buf))
         {
-            for (int j = 0; j <= i; j++)
-                kfree(args->args.matrix_multiplication.a[j]);
-            for (int j = 0; j < i; j++)
-                kfree(args->args.matrix_multiplication.b[j]);
-            kfree(args->args.matrix_multiplication.a);
-            kfree(args->args.matrix_multiplication.b);
-            kfree(args->args.matrix_multiplication.result);
-            kfree(args);
-            return -1;
-        }
-
-        args->args.matrix_multiplication.result[i] = kzalloc(size * sizeof(int), GFP_KERNEL);
-        if (!args->args.matrix_multiplication.result[i])
-        {
-            for (int j = 0; j <= i; j++)
-                kfree(args->args.matrix_multiplication.a[j]);
-            for (int j = 0; j <= i; j++)
-                kfree(args->args.matrix_multiplication.b[j]);
-            for (int j = 0; j < i; j++)
-                kfree(args->args.matrix_multiplication.result[j]);
-            kfree(args->args.matrix_multiplication.a);
-            kfree(args->args.matrix_multiplication.b);
-            kfree(args->args.matrix_multiplication.result);
-            kfree(args);
-            return -1;
+            pr_err("%s: Failed to allocate %dx%d matrices\n", THIS_MODULE->name, size, size);
+            return -ENOMEM;
         }
+        buf->nr_ints = nr_ints;
+        atomic64_inc(&op_matrix_allocs);
     }
 
-    return 1;
+    args->args.matrix_multiplication.buf = buf;
+    args->args.matrix_multiplication.a = buf->data;
+    args->args.matrix_multiplication.b = buf->data + (size_t)size * size;
+    args->args.matrix_multiplication.result = buf->data + 2 * (size_t)size * size;
+    // same inputs as a fresh allocation, result is written by the kernel
+    memset(buf->data, 0, 2 * (size_t)size * size * sizeof(int));
+    return 0;
 }
+
 void op_cpu_matrix_multiplication_free(op_cpu_args_t *args)
 {
-    for (int i = 0; i < args->args.matrix_multiplication.size; i++)
-    {
-        kfree(args->args.matrix_multiplication.a[i]);
-        kfree(args->args.matrix_multiplication.b[i]);
-        kfree(args->args.matrix_multiplication.result[i]);
-    }
-    kfree(args->args.matrix_multiplication.result);
-    kfree(args->args.matrix_multiplication.b);
-    kfree(args->args.matrix_multiplication.a);
+    struct op_matrix_buf *buf = args->args.matrix_multiplication.buf;
+
+    args->args.matrix_multiplication.buf = NULL;
+    args->args.matrix_multiplication.a = NULL;
+    args->args.matrix_multiplication.b = NULL;
+    args->args.matrix_multiplication.result = NULL;
+    // keep the most recent one, it is the warmest in the caches
+    kvfree(this_cpu_xchg(op_matrix_buf_cache, buf));
 }
 
 void op_cpu_matrix_multiplication(op_cpu_args_t *args)
 {
-    int size = args->args.matrix_multiplication.size;
-    for (int i = 0; i < size; i++)
+    matrix_mul(args->args.matrix_multiplication.a, args->args.matrix_multiplication.b,
+               args->args.matrix_multiplication.result, args->args.matrix_multiplication.size);
+}
+
+u64 op_cpu_matrix_nr_allocs(void) { return atomic64_read(&op_matrix_allocs); }
+
+void op_cpu_matrix_cache_free(void)
+{
+    int cpu;
+
+    for_each_possible_cpu(cpu)
     {
-        for (int j = 0; j < size; j++)
-        {
-            args->args.matrix_multiplication.result[i][j] = 0;
-            for (int k = 0; k < size; k++)
-                args->args.matrix_multiplication.result[i][j] +=
-                    args->args.matrix_multiplication.a[i][k] * args->args.matrix_multiplication.b[k][j];
-        }
+        kvfree(per_cpu(op_matrix_buf_cache, cpu));
+        per_cpu(op_matrix_buf_cache, cpu) = NULL;
     }
 }
 
@@ -264,15 +242,20 @@ int op_network_send(op_network_args_t *args)
     int ret = 0;
     for (int i = 0; i < args->args.send.iterations; i++)
     {
-        if (args->lock)
-            spin_lock(args->lock);
-        ret = ksocket_write((struct ksocket_handler){
-            .sock = args->sock,
-            .buf = args->args.send.payload,
-            .len = args->args.send.size_payload,
-        });
-        if (args->lock)
-            spin_unlock(args->lock);
+        // the client tx work is the only writer of its socket, no need to
+        // lock anything here, it will coalesce with other pending messages
+        if (args->client)
+        {
+            ret = client_tx_enqueue(args->client, args->args.send.payload, args->args.send.size_payload);
+            if (ret >= 0)
+                atomic64_inc(&op_network_allocs);
+        }
+        else
+            ret = ksocket_write((struct ksocket_handler){
+                .sock = args->sock,
+                .buf = args->args.send.payload,
+                .len = args->args.send.size_payload,
+            });
         if (ret < 0)
             break;
     }
@@ -280,10 +263,20 @@ int op_network_send(op_network_args_t *args)
     return ret;
 }
 
+u64 op_network_nr_allocs(void) { return atomic64_read(&op_network_allocs); }
+
 int op_network_conn_send(op_network_args_t *args)
 {
     int ret = 0;
     struct socket *sock;
+
+    if (args->args.conn_send.pool && args->args.conn_send.pages)
+        return conn_pool_send_pages(args->args.conn_send.pool, args->args.conn_send.pages,
+                                    args->args.conn_send.iterations);
+    if (args->args.conn_send.pool)
+        return conn_pool_send(args->args.conn_send.pool, args->args.conn_send.payload,
+                              args->args.conn_send.size_payload, args->args.conn_send.iterations);
+
     ret = connect_lsocket_addr(&sock, args->args.conn_send.ip, args->args.conn_send.port);
     if (unlikely(ret < 0))
     {
@@ -302,11 +295,12 @@ int op_network_conn_send(op_network_args_t *args)
             break;
     }
 
-    ret = close_lsocket(sock);
-    if (unlikely(ret < 0))
+    // a failed or timed out send is the result, not the close that follows
+    int res = close_lsocket(sock);
+    if (unlikely(res < 0))
     {
-        pr_err("Failed to close socket for %s:%d: %d\n", args->args.conn_send.ip, args->args.conn_send.port, ret);
-        return ret;
+        pr_err("Failed to close socket for %s:%d: %d\n", args->args.conn_send.ip, args->args.conn_send.port, res);
+        return ret < 0 ? ret : res;
     }
 
     return ret;
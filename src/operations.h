@@ -8,6 +8,8 @@
 #define BUFFER_SIZE_IO 4096
 #endif
 
+struct op_matrix_buf;
+
 typedef struct
 {
     union
@@ -15,9 +17,12 @@ typedef struct
         struct
         {
             int size;
-            int **a;
-            int **b;
-            int **result;
+            // size x size row-major, in one buffer taken from the per-CPU cache (see
+            // op_cpu_matrix_multiplication_init)
+            int *a;
+            int *b;
+            int *result;
+            struct op_matrix_buf *buf;
         } matrix_multiplication;
     } args;
 } op_cpu_args_t;
@@ -44,10 +49,14 @@ typedef struct
     } args;
 } op_disk_args_t;
 
+struct _client;
+struct conn_pool_entry;
+struct page_buf;
+
 typedef struct
 {
     struct socket *sock;
-    spinlock_t *lock; // Optional, for thread safety
+    struct _client *client; // Optional, when set send only enqueues on the client tx queue
     union
     {
         struct
@@ -60,6 +69,8 @@ typedef struct
         {
             char *ip;
             int port;
+            struct conn_pool_entry *pool; // Optional, when set a persistent connection of the pool is used
+            struct page_buf *pages;       // Optional, payload shared by reference and spliced (needs pool)
             void *payload;
             int size_payload;
             int iterations;
@@ -67,13 +78,33 @@ typedef struct
     } args;
 } op_network_args_t;
 
+/*
+ * op_cpu_matrix_multiplication_init - Set up a, b (zeroed) and result, in a buffer reused from the cache of the
+ * current CPU when it is large enough
+ * @return 0 or -ENOMEM.
+ */
 int op_cpu_matrix_multiplication_init(op_cpu_args_t *args);
+/*
+ * op_cpu_matrix_multiplication_free - Give the buffer back to the cache of the current CPU
+ */
 void op_cpu_matrix_multiplication_free(op_cpu_args_t *args);
 void op_cpu_matrix_multiplication(op_cpu_args_t *args);
+/*
+ * op_cpu_matrix_nr_allocs - Buffers allocated by op_cpu_matrix_multiplication_init, the ones missing the cache
+ */
+u64 op_cpu_matrix_nr_allocs(void);
+/*
+ * op_cpu_matrix_cache_free - Free the cached buffers, once no cpu op can run anymore
+ */
+void op_cpu_matrix_cache_free(void);
 
 int op_disk_word_counting(op_disk_args_t *args);
 ssize_t op_disk_read(op_disk_args_t *args);
 ssize_t op_disk_write(op_disk_args_t *args);
 
 int op_network_send(op_network_args_t *args);
+/*
+ * op_network_nr_allocs - Messages allocated by op_network_send for the client tx queue
+ */
+u64 op_network_nr_allocs(void);
 int op_network_conn_send(op_network_args_t *args);
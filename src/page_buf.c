@@ -0,0 +1,77 @@
+#include <linux/gfp.h>
+#include <linux/highmem.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+
+#include "page_buf.h"
+#include "stats.h"
+
+static atomic64_t stat_allocs = ATOMIC64_INIT(0);
+static atomic64_t stat_frees = ATOMIC64_INIT(0);
+static atomic64_t stat_bytes_copied = ATOMIC64_INIT(0);
+
+static void page_buf_release_pages(struct page_buf *pb)
+{
+    for (unsigned int i = 0; i < pb->nr_pages; i++)
+        put_page(pb->bvec[i].bv_page);
+}
+
+struct page_buf *page_buf_alloc(const void *data, size_t len)
+{
+    unsigned int nr_pages = DIV_ROUND_UP(len, PAGE_SIZE);
+    struct page_buf *pb = kmalloc(struct_size(pb, bvec, nr_pages), GFP_KERNEL);
+    if (unlikely(!pb))
+        return NULL;
+
+    kref_init(&pb->ref);
+    pb->len = len;
+    pb->nr_pages = 0;
+
+    for (size_t off = 0; off < len; off += PAGE_SIZE)
+    {
+        size_t chunk = min_t(size_t, len - off, PAGE_SIZE);
+        struct page *page = alloc_page(GFP_KERNEL);
+        if (unlikely(!page))
+        {
+            page_buf_release_pages(pb);
+            kfree(pb);
+            return NULL;
+        }
+
+        memcpy_to_page(page, 0, data + off, chunk);
+        pb->bvec[pb->nr_pages++] = (struct bio_vec){
+            .bv_page = page,
+            .bv_len = chunk,
+            .bv_offset = 0,
+        };
+    }
+
+    atomic64_inc(&stat_allocs);
+    atomic64_add(len, &stat_bytes_copied);
+    return pb;
+}
+
+static void page_buf_release(struct kref *ref)
+{
+    struct page_buf *pb = container_of(ref, struct page_buf, ref);
+
+    page_buf_release_pages(pb);
+    kfree(pb);
+    atomic64_inc(&stat_frees);
+}
+
+void page_buf_put(struct page_buf *pb)
+{
+    if (pb)
+        kref_put(&pb->ref, page_buf_release);
+}
+
+static int page_buf_stats_show(struct seq_file *m, void *v)
+{
+    seq_printf(m, "allocs=%llu frees=%llu bytes_copied=%llu\n", atomic64_read(&stat_allocs),
+               atomic64_read(&stat_frees), atomic64_read(&stat_bytes_copied));
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(page_buf_stats);
+
+void page_buf_stats_init(void) { kserver_stats_create_file("page_buf", &page_buf_stats_fops); }
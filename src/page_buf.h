@@ -0,0 +1,33 @@
+#pragma once
+#include <linux/bvec.h>
+#include <linux/kref.h>
+#include <linux/types.h>
+
+/*
+ * Payload copied once in its own pages and shared by reference, the bvec
+ * array is built at allocation and never modified afterwards so any
+ * number of senders can splice it concurrently.
+ */
+struct page_buf
+{
+    struct kref ref;
+    size_t len;
+    unsigned int nr_pages;
+    struct bio_vec bvec[];
+};
+
+/*
+ * page_buf_alloc - Allocate pages for len bytes and copy data in them, the only copy of the payload.
+ * @return the buffer with one reference or NULL on allocation failure.
+ */
+struct page_buf *page_buf_alloc(const void *data, size_t len);
+
+static inline void page_buf_get(struct page_buf *pb) { kref_get(&pb->ref); }
+
+/*
+ * page_buf_put - Drop a reference, the pages are released with the last one. Pages already handed to the
+ * network stack stay alive until it is done with them (it holds its own page references).
+ */
+void page_buf_put(struct page_buf *pb);
+
+void page_buf_stats_init(void);
@@ -0,0 +1,145 @@
+#include <linux/cpumask.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/percpu.h>
+#include <linux/topology.h>
+#include <net/sock.h>
+
+#include "client.h"
+#include "placement.h"
+#include "stats.h"
+#include "task.h"
+
+static int placement = PLACE_LOCAL;
+module_param(placement, int, 0644);
+MODULE_PARM_DESC(placement, "Where successors are queued (0: queue_work, default, 1: same CPU as the predecessor, "
+                            "2: RX CPU of the connection, 3: same LLC, 4: least loaded CPU of the RX NUMA node)");
+
+// predicted ns of the client_work placed on the CPU and not started yet
+static DEFINE_PER_CPU(atomic64_t, placement_load);
+
+// an op never measured weighs as much as a 100us one
+#define PLACEMENT_UNKNOWN_COST_NS (100 * NSEC_PER_USEC)
+
+static atomic64_t stat_requests = ATOMIC64_INIT(0);
+static atomic64_t stat_hops = ATOMIC64_INIT(0);
+static atomic64_t stat_cross_cpu = ATOMIC64_INIT(0);
+static atomic64_t stat_cross_llc = ATOMIC64_INIT(0);
+static atomic64_t stat_cross_node = ATOMIC64_INIT(0);
+
+/*
+ * CPUs sharing the last level cache of cpu. The LLC map of the scheduler
+ * is not exported to modules, the package is the closest topology mask
+ * (equal to the LLC on most Intel parts, wider on CCX based AMD ones).
+ */
+static const struct cpumask *placement_llc_mask(int cpu) { return topology_core_cpumask(cpu); }
+
+static int placement_rx_cpu(const struct client_request *req, int fallback)
+{
+    struct sock *sk;
+    int cpu;
+
+    if (!req || !req->cl || !req->cl->sock || !(sk = req->cl->sock->sk))
+        return fallback;
+
+    cpu = READ_ONCE(sk->sk_incoming_cpu);
+    if (cpu < 0 || cpu >= nr_cpu_ids || !cpu_online(cpu))
+        return fallback;
+    return cpu;
+}
+
+static s64 placement_cost(u64 cost_ns)
+{
+    if (cost_ns == U64_MAX)
+        return PLACEMENT_UNKNOWN_COST_NS;
+    return clamp_t(u64, cost_ns, 1, S64_MAX);
+}
+
+static int placement_least_loaded(const struct cpumask *mask, int preferred)
+{
+    int best = preferred;
+    s64 best_load = S64_MAX;
+    int cpu;
+
+    // the preferred CPU wins the ties
+    if (cpumask_test_cpu(preferred, mask) && cpu_online(preferred))
+        best_load = atomic64_read(per_cpu_ptr(&placement_load, preferred));
+
+    for_each_cpu_and(cpu, mask, cpu_online_mask)
+    {
+        s64 load = atomic64_read(per_cpu_ptr(&placement_load, cpu));
+        if (load < best_load)
+        {
+            best = cpu;
+            best_load = load;
+        }
+    }
+    return best;
+}
+
+int placement_select_cpu(const struct client_request *req, u64 cost_ns)
+{
+    int here = raw_smp_processor_id();
+    int cpu;
+
+    switch (READ_ONCE(placement))
+    {
+    case PLACE_SAME_CPU:
+        cpu = here;
+        break;
+    case PLACE_RX_CPU:
+        cpu = placement_rx_cpu(req, here);
+        break;
+    case PLACE_LLC:
+        cpu = placement_least_loaded(placement_llc_mask(here), here);
+        break;
+    case PLACE_NUMA:
+        cpu = placement_rx_cpu(req, here);
+        cpu = placement_least_loaded(cpumask_of_node(cpu_to_node(cpu)), cpu);
+        break;
+    default:
+        return WORK_CPU_UNBOUND;
+    }
+
+    atomic64_add(placement_cost(cost_ns), per_cpu_ptr(&placement_load, cpu));
+    return cpu;
+}
+
+void placement_account_exec(int pred_cpu, int placed_cpu, u64 cost_ns)
+{
+    int here = raw_smp_processor_id();
+
+    if (placed_cpu != WORK_CPU_UNBOUND)
+        atomic64_sub(placement_cost(cost_ns), per_cpu_ptr(&placement_load, placed_cpu));
+
+    atomic64_inc(&stat_hops);
+    if (pred_cpu == here)
+        return;
+    atomic64_inc(&stat_cross_cpu);
+    if (!cpumask_test_cpu(pred_cpu, placement_llc_mask(here)))
+        atomic64_inc(&stat_cross_llc);
+    if (cpu_to_node(pred_cpu) != cpu_to_node(here))
+        atomic64_inc(&stat_cross_node);
+}
+
+void placement_account_request(void) { atomic64_inc(&stat_requests); }
+
+static int placement_stats_show(struct seq_file *m, void *v)
+{
+    static const char *const names[] = {"local", "same_cpu", "rx_cpu", "llc", "numa"};
+    int policy = READ_ONCE(placement);
+    s64 requests = atomic64_read(&stat_requests);
+    s64 cross_cpu = atomic64_read(&stat_cross_cpu);
+    s32 cross_cpu_frac;
+    s64 cross_cpu_x100 = requests ? div64_s64(cross_cpu * 100, requests) : 0;
+
+    seq_printf(m, "placement=%s requests=%lld hops=%lld cross_cpu=%lld cross_llc=%lld cross_node=%lld\n",
+               policy >= 0 && policy < ARRAY_SIZE(names) ? names[policy] : "local", requests,
+               atomic64_read(&stat_hops), cross_cpu, atomic64_read(&stat_cross_llc), atomic64_read(&stat_cross_node));
+    seq_printf(m, "cross_cpu_per_request=%lld.%02d\n", div_s64_rem(cross_cpu_x100, 100, &cross_cpu_frac),
+               cross_cpu_frac);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(placement_stats);
+
+void placement_stats_init(void) { kserver_stats_create_file("placement", &placement_stats_fops); }
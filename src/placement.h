@@ -0,0 +1,37 @@
+#pragma once
+#include <linux/workqueue.h>
+
+struct client_request;
+
+enum placement_policy
+{
+    PLACE_LOCAL,    // queue_work, the workqueue decides
+    PLACE_SAME_CPU, // CPU of the predecessor (the rx worker for the first stage)
+    PLACE_RX_CPU,   // CPU where the softirq of the client socket ran (sk_incoming_cpu)
+    PLACE_LLC,      // least loaded CPU sharing the last level cache with the predecessor
+    PLACE_NUMA,     // least loaded CPU of the NUMA node of the RX CPU
+    // the load of a CPU is the predicted cost of the client_work placed on it (see predictor.h)
+};
+
+/*
+ * placement_select_cpu - CPU to queue the next client_work of req on, following the placement parameter
+ * @cost_ns: predicted runtime of the client_work (see client_work_cost_ns), U64_MAX when unknown
+ * @return a CPU for queue_work_on() or WORK_CPU_UNBOUND, the CPU is accounted as loaded by cost_ns until
+ * placement_account_exec() runs.
+ */
+int placement_select_cpu(const struct client_request *req, u64 cost_ns);
+
+/*
+ * placement_account_exec - Called when a queued client_work starts, counts the hop from the CPU that queued it
+ * @pred_cpu: CPU that queued the client_work
+ * @placed_cpu: value returned by placement_select_cpu()
+ * @cost_ns: cost_ns given to placement_select_cpu()
+ */
+void placement_account_exec(int pred_cpu, int placed_cpu, u64 cost_ns);
+
+/*
+ * placement_account_request - Called once per completed request, for the hops per request
+ */
+void placement_account_request(void);
+
+void placement_stats_init(void);
@@ -0,0 +1,105 @@
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+
+#include "predictor.h"
+#include "stats.h"
+
+#define PREDICTOR_MAX 64
+
+static int predictor_shift = 3;
+module_param(predictor_shift, int, 0644);
+MODULE_PARM_DESC(predictor_shift, "EWMA weight of a new runtime sample is 1/2^shift (default: 3)");
+
+static int predictor_sigmas = 1;
+module_param(predictor_sigmas, int, 0644);
+MODULE_PARM_DESC(predictor_sigmas, "Standard deviations added to the mean in the predicted cost (default: 1)");
+
+static struct predictor predictors[PREDICTOR_MAX];
+static int nr_predictors = 0;
+static DEFINE_MUTEX(predictors_lock);
+
+struct predictor *predictor_get(enum task_type type, int param)
+{
+    struct predictor *p = NULL;
+
+    mutex_lock(&predictors_lock);
+    for (int i = 0; i < nr_predictors; i++)
+    {
+        if (predictors[i].type == type && predictors[i].param == param)
+        {
+            p = &predictors[i];
+            goto out;
+        }
+    }
+
+    if (unlikely(nr_predictors == PREDICTOR_MAX))
+    {
+        pr_warn("%s: predictor table full, %s(%d) uses the per op average\n", THIS_MODULE->name, task_op_name(type),
+                param);
+        goto out;
+    }
+    p = &predictors[nr_predictors++];
+    p->type = type;
+    p->param = param;
+
+out:
+    mutex_unlock(&predictors_lock);
+    return p;
+}
+
+void predictor_update(struct predictor *p, u64 ns)
+{
+    int shift = clamp(READ_ONCE(predictor_shift), 0, 16);
+    u64 mean = READ_ONCE(p->mean_ns);
+    s64 diff = (s64)ns - (s64)mean;
+    u64 abs_diff = abs(diff);
+
+    if (atomic64_inc_return(&p->samples) == 1)
+    {
+        // first sample, nothing was predicted
+        WRITE_ONCE(p->mean_ns, ns);
+        return;
+    }
+
+    atomic64_add(abs_diff, &p->abs_err_ns);
+    if (ns)
+        atomic64_add(div64_u64(abs_diff * 100, ns), &p->rel_err_pct);
+
+    // EWMA of the mean and of the squared deviation (West's update)
+    WRITE_ONCE(p->mean_ns, mean + (diff >> shift));
+    s64 var = READ_ONCE(p->var_ns2);
+    u64 sq = abs_diff > U32_MAX ? U64_MAX : abs_diff * abs_diff;
+    WRITE_ONCE(p->var_ns2, var + (((s64)min_t(u64, sq, S64_MAX) - var) >> shift));
+}
+
+u64 predictor_estimate(const struct predictor *p)
+{
+    u64 mean = READ_ONCE(p->mean_ns);
+
+    if (!mean)
+        return 0;
+    return mean + READ_ONCE(predictor_sigmas) * int_sqrt64(READ_ONCE(p->var_ns2));
+}
+
+static int predictor_stats_show(struct seq_file *m, void *v)
+{
+    mutex_lock(&predictors_lock);
+    for (int i = 0; i < nr_predictors; i++)
+    {
+        const struct predictor *p = &predictors[i];
+        s64 samples = atomic64_read(&p->samples);
+        s64 errors = samples > 1 ? samples - 1 : 0;
+
+        seq_printf(m, "%s(%d) samples=%lld mean_ns=%llu stddev_ns=%llu estimate_ns=%llu mae_ns=%lld rel_err_pct=%lld\n",
+                   task_op_name(p->type), p->param, samples, READ_ONCE(p->mean_ns),
+                   (u64)int_sqrt64(READ_ONCE(p->var_ns2)), predictor_estimate(p),
+                   errors ? div64_s64(atomic64_read(&p->abs_err_ns), errors) : 0,
+                   errors ? div64_s64(atomic64_read(&p->rel_err_pct), errors) : 0);
+    }
+    mutex_unlock(&predictors_lock);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(predictor_stats);
+
+void predictor_stats_init(void) { kserver_stats_create_file("predictor", &predictor_stats_fops); }
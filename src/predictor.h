@@ -0,0 +1,39 @@
+#pragma once
+#include <linux/atomic.h>
+#include <linux/types.h>
+
+#include "task.h"
+
+/*
+ * Execution time model of one (op, parameter) pair, EWMA of the runtime and of its variance
+ */
+struct predictor
+{
+    enum task_type type;
+    int param;
+    u64 mean_ns;
+    u64 var_ns2;
+    // prediction error of the updates, against the mean before the update
+    atomic64_t samples;
+    atomic64_t abs_err_ns;
+    atomic64_t rel_err_pct; // sum of |err| / actual in percent
+};
+
+/*
+ * predictor_get - Model of the ops of type run with param, created on first use
+ * @return the model or NULL when the table is full (the callers then fall back to the per op average).
+ */
+struct predictor *predictor_get(enum task_type type, int param);
+
+/*
+ * predictor_update - Feed a measured runtime, lockless: concurrent updates of one model may lose a sample
+ */
+void predictor_update(struct predictor *p, u64 ns);
+
+/*
+ * predictor_estimate - Predicted runtime, mean + predictor_sigmas standard deviations
+ * @return the estimate in ns, or 0 when nothing was measured yet.
+ */
+u64 predictor_estimate(const struct predictor *p);
+
+void predictor_stats_init(void);
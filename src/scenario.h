@@ -3,21 +3,32 @@
 #include "mom.h"
 #include "only_cpu.h"
 
+// Every scenario is a prebuilt task graph, see dag.h for the description format
 #define SCENARIO_LIST                                                                                                  \
-    X(ONLY_CPU, "One CPU task")                                                                                        \
-    X(MOM_PUBLISH, "MOM Publish scenario, multiple steps")
+    X(ONLY_CPU, "One CPU task", "cpu=cpu(1000)@only_cpu_wq")                                                           \
+    X(MOM_PUBLISH, "MOM Publish scenario, multiple steps",                                                             \
+      "n_cpu=cpu(100)@mom_first_step;"                                                                                 \
+      "cpu=cpu(100)@mom_second_step_cpu;"                                                                              \
+      "disk=disk(1)@mom_second_step_disk;"                                                                             \
+      "notify=notify(1)@mom_third_step_net_notify_sub;"                                                                \
+      "ack=ack(1)@mom_third_step_net_ack;"                                                                             \
+      "n_cpu>cpu,disk;cpu>notify,ack;disk>ack")
 
-#define X(name, description) name,
+#define X(name, description, dag) name,
 typedef enum
 {
     SCENARIO_LIST SCENARIO_COUNT
 } scenario_t;
 #undef X
 
-#define X(name, description) description,
+#define X(name, description, dag) description,
 static const char *scenario_descriptions[] = {SCENARIO_LIST};
 #undef X
 
+#define X(name, description, dag) dag,
+static const char *scenario_dags[] = {SCENARIO_LIST};
+#undef X
+
 static inline const char *get_scenario_description(scenario_t scenario)
 {
     if (scenario < 0 || scenario >= SCENARIO_COUNT)
@@ -25,4 +36,11 @@ static inline const char *get_scenario_description(scenario_t scenario)
     return scenario_descriptions[scenario];
 }
 
+static inline const char *get_scenario_dag(scenario_t scenario)
+{
+    if (scenario < 0 || scenario >= SCENARIO_COUNT)
+        return NULL;
+    return scenario_dags[scenario];
+}
+
 static inline bool is_scenario_valid(scenario_t scenario) { return scenario >= 0 && scenario < SCENARIO_COUNT; }
\ No newline at end of file
@@ -0,0 +1,29 @@
+#include "stats.h"
+#include <linux/err.h>
+#include <linux/module.h>
+
+static struct dentry *stats_dir;
+
+int kserver_stats_init(void)
+{
+    stats_dir = debugfs_create_dir(THIS_MODULE->name, NULL);
+    if (IS_ERR_OR_NULL(stats_dir))
+    {
+        // not fatal, counters are still printed when the module is removed
+        pr_warn("%s: debugfs not available, stats files disabled\n", THIS_MODULE->name);
+        stats_dir = NULL;
+    }
+    return 0;
+}
+
+void kserver_stats_create_file(const char *name, const struct file_operations *fops)
+{
+    if (stats_dir)
+        debugfs_create_file(name, 0444, stats_dir, NULL, fops);
+}
+
+void kserver_stats_free(void)
+{
+    debugfs_remove_recursive(stats_dir);
+    stats_dir = NULL;
+}
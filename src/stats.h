@@ -0,0 +1,19 @@
+#pragma once
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+/*
+ * kserver_stats_init - Create the kserver debugfs directory (/sys/kernel/debug/kserver)
+ * every subsystem drops its counters file in.
+ * @return 0 on success, negative error code on failure.
+ */
+int kserver_stats_init(void);
+
+/*
+ * kserver_stats_create_file - Expose a read-only seq_file (see DEFINE_SHOW_ATTRIBUTE) under the kserver directory
+ * @name: file name
+ * @fops: file operations, usually <name>_fops generated by DEFINE_SHOW_ATTRIBUTE
+ */
+void kserver_stats_create_file(const char *name, const struct file_operations *fops);
+
+void kserver_stats_free(void);
@@ -1,103 +1,626 @@
 #include "task.h"
+#include "admission.h"
+#include "client.h"
+#include "dag.h"
+#include "executor.h"
 #include "ksocket_handler.h"
+#include "page_buf.h"
+#include "placement.h"
+#include "predictor.h"
+#include "stats.h"
+#include <linux/ktime.h>
+#include <linux/math64.h>
 #include <linux/module.h>
 
-void w_cpu(struct work_struct *work)
+enum exec_mode
 {
-    struct client_work *c_task = container_of(work, struct client_work, work);
-    // TODO: make generic call function here
-    int res = op_cpu_matrix_multiplication_init(&c_task->t.args.cpu_args);
-    if (unlikely(res < 0))
+    EXEC_STAGED,            // every stage is queued on its workqueue
+    EXEC_RUN_TO_COMPLETION, // the request runs on the worker that parsed it, only parallel branches are queued
+    EXEC_MODE_COUNT,
+};
+
+static int exec_mode = EXEC_STAGED;
+module_param(exec_mode, int, 0644);
+MODULE_PARM_DESC(exec_mode, "Request execution (0: staged across the workqueues, default, 1: run-to-completion on the "
+                            "rx worker)");
+
+static unsigned long fuse_threshold_ns = 0;
+module_param(fuse_threshold_ns, ulong, 0644);
+MODULE_PARM_DESC(fuse_threshold_ns, "Run a ready successor inline instead of queueing it when its measured average "
+                                    "cost is below this many ns (default: 0, always queue)");
+
+static unsigned int request_deadline_us = 0;
+module_param(request_deadline_us, uint, 0644);
+MODULE_PARM_DESC(request_deadline_us, "Deadline of a request after it is parsed, 0 for none (default: 0)");
+
+static unsigned int request_timeout_us = 0;
+module_param(request_timeout_us, uint, 0644);
+MODULE_PARM_DESC(request_timeout_us, "Cancel a request still running this long after it is parsed, 0 for none "
+                                     "(default: 0)");
+
+static unsigned int stage_timeout_us = 0;
+module_param(stage_timeout_us, uint, 0644);
+MODULE_PARM_DESC(stage_timeout_us, "Cancel the request of a stage whose op ran longer than this, 0 for none "
+                                   "(default: 0)");
+
+static unsigned int deadline_urgent_us = 1000;
+module_param(deadline_urgent_us, uint, 0644);
+MODULE_PARM_DESC(deadline_urgent_us, "Slack under which a stage is urgent and dispatched on the HIGHPRI sibling "
+                                     "queue (default: 1000)");
+
+static int batch_max_size = 1;
+module_param(batch_max_size, int, 0644);
+MODULE_PARM_DESC(batch_max_size, "Client_work of a cpu stage queued while one is pending join its batch, run in one "
+                                 "pass with a shared setup, up to this many (default: 1, no batching)");
+
+static unsigned int batch_max_delay_us = 0;
+module_param(batch_max_delay_us, uint, 0644);
+MODULE_PARM_DESC(batch_max_delay_us, "How long the leader of a batch that is not full waits for more members when "
+                                     "it starts (default: 0)");
+
+#define REQ_LAT_BUCKETS 64
+
+// end-to-end latency per execution mode, bucket b holds [2^(b-1), 2^b) ns
+// (the last one everything above)
+struct req_lat_stats
+{
+    atomic64_t completed;
+    atomic64_t total_ns;
+    atomic64_t deadline_missed;
+    atomic64_t cancelled; // not in the latency
+    atomic64_t hist[REQ_LAT_BUCKETS];
+};
+
+static struct req_lat_stats req_lat_stats[EXEC_MODE_COUNT];
+
+struct client_request *client_request_alloc(struct _client *cl)
+{
+    struct client_request *req = kzalloc(sizeof(struct client_request), GFP_KERNEL);
+    if (unlikely(!req))
+        return NULL;
+
+    atomic_set(&req->pending, 0);
+    // the client may close while the request runs
+    if (cl)
+        client_get(cl);
+    req->cl = cl;
+    req->start_ns = ktime_get_ns();
+    if (READ_ONCE(request_deadline_us))
+        req->deadline_ns = req->start_ns + (u64)READ_ONCE(request_deadline_us) * NSEC_PER_USEC;
+    if (READ_ONCE(request_timeout_us))
+        req->timeout_ns = req->start_ns + (u64)READ_ONCE(request_timeout_us) * NSEC_PER_USEC;
+    atomic_set(&req->cancelled, 0);
+    req->run_to_completion = READ_ONCE(exec_mode) == EXEC_RUN_TO_COMPLETION;
+    return req;
+}
+
+void client_request_complete(struct client_request *req)
+{
+    if (req->inst)
     {
-        pr_err("%s: Failed to w_cpu: %d\n", THIS_MODULE->name, res);
-        return;
+        struct req_lat_stats *st = &req_lat_stats[req->run_to_completion ? EXEC_RUN_TO_COMPLETION : EXEC_STAGED];
+        u64 now = ktime_get_ns();
+        u64 lat = now - req->start_ns;
+
+        if (atomic_read(&req->cancelled))
+            atomic64_inc(&st->cancelled);
+        else
+        {
+            atomic64_inc(&st->completed);
+            if (req->deadline_ns && now > req->deadline_ns)
+                atomic64_inc(&st->deadline_missed);
+            atomic64_add(lat, &st->total_ns);
+            atomic64_inc(&st->hist[min(fls64(lat), REQ_LAT_BUCKETS - 1)]);
+        }
+        placement_account_request();
+        dag_instance_release(req->inst);
     }
+    admission_exit(req->cl);
+    if (req->cl)
+        client_put(req->cl);
+    kfree(req);
+}
+
+static u64 task_op_cost_ns(enum task_type type);
+
+static void client_work_run(struct client_work *c_task);
+
+u64 client_work_deadline(const struct client_work *cw) { return cw->req ? cw->req->deadline_ns : 0; }
+
+bool client_request_cancel(struct client_request *req) { return atomic_cmpxchg(&req->cancelled, 0, 1) == 0; }
+
+/*
+ * Whether the request of cw was cancelled or is past its timeout, checked before running cw
+ */
+static bool client_work_cancelled(const struct client_work *cw, u64 now)
+{
+    struct client_request *req = cw->req;
+
+    if (!req)
+        return false;
+    if (req->timeout_ns && now > req->timeout_ns)
+        client_request_cancel(req);
+    return atomic_read(&req->cancelled);
+}
+
+u64 client_work_cost_ns(const struct client_work *cw)
+{
+    u64 cost = cw->pred ? predictor_estimate(cw->pred) : 0;
+
+    return cost ? cost : task_op_cost_ns(cw->type);
+}
+
+bool client_work_urgent(const struct client_work *cw)
+{
+    u64 deadline = client_work_deadline(cw);
+    u64 cost;
 
-    op_cpu_matrix_multiplication(&c_task->t.args.cpu_args);
-    op_cpu_matrix_multiplication_free(&c_task->t.args.cpu_args);
-    // pr_info("%s: CPU operation finished\n", THIS_MODULE->name);
+    if (!deadline)
+        return false;
+    // an op never measured doesn't make everything urgent
+    cost = client_work_cost_ns(cw);
+    if (cost == U64_MAX)
+        cost = 0;
+    return ktime_get_ns() + cost + (u64)READ_ONCE(deadline_urgent_us) * NSEC_PER_USEC >= deadline;
+}
 
-    // pr_info("%s: PID of w_cpu: %d\n", THIS_MODULE->name, get_current()->pid);
-    for (int i = 0; i < c_task->total_next_workqueue; i++)
+void stage_batch_init(struct stage_batch *b)
+{
+    spin_lock_init(&b->lock);
+    b->open = NULL;
+    init_waitqueue_head(&b->full);
+}
+
+/*
+ * Add cw to the open batch of its stage, or open one led by cw
+ * @return true when cw joined a batch, it runs with its leader and must not be queued.
+ */
+static bool client_work_batch_add(struct client_work *cw)
+{
+    struct stage_batch *b = cw->batch;
+    int max = READ_ONCE(batch_max_size);
+    struct client_work *leader;
+    bool joined = false;
+
+    if (!b || max <= 1)
+        return false;
+
+    spin_lock(&b->lock);
+    leader = b->open;
+    if (leader && leader->batch_nr < max)
     {
-        struct next_workqueue *next_wq = &c_task->next_works[i];
-        INIT_WORK(&next_wq->cw->work, next_wq->func);
-        queue_work(next_wq->wq, &next_wq->cw->work);
+        // the leader does the placement accounting of its members
+        cw->placed_cpu = WORK_CPU_UNBOUND;
+        cw->placed_ns = 0;
+        list_add_tail(&cw->ws_node, &leader->batch_members);
+        if (++leader->batch_nr >= max)
+        {
+            b->open = NULL;
+            wake_up(&b->full);
+        }
+        joined = true;
+    }
+    else
+    {
+        INIT_LIST_HEAD(&cw->batch_members);
+        cw->batch_nr = 1;
+        b->open = cw;
     }
+    spin_unlock(&b->lock);
+    return joined;
 }
 
-void w_net(struct work_struct *work)
+/*
+ * Stop leader from accepting members, after waiting batch_max_delay_us for it to fill up
+ * @members: receives the members, without the leader
+ * @return the size of the batch, leader included.
+ */
+static int client_work_batch_close(struct client_work *leader, struct list_head *members)
 {
-    struct client_work *c_task = container_of(work, struct client_work, work);
-    // TODO: make generic call function here
-    int res = op_network_send(&c_task->t.args.net_args);
-    if (unlikely(res < 0))
+    struct stage_batch *b = leader->batch;
+    unsigned int delay_us = READ_ONCE(batch_max_delay_us);
+    int nr;
+
+    if (delay_us && READ_ONCE(b->open) == leader)
+        wait_event_hrtimeout(b->full, READ_ONCE(b->open) != leader, us_to_ktime(delay_us));
+
+    spin_lock(&b->lock);
+    if (b->open == leader)
+        b->open = NULL;
+    list_splice_init(&leader->batch_members, members);
+    nr = leader->batch_nr;
+    leader->batch_nr = 0;
+    spin_unlock(&b->lock);
+    return nr;
+}
+
+/*
+ * Queue an initialized client_work on the CPU picked by the placement policy
+ */
+static void client_work_queue(struct exec_queue *q, struct client_work *cw)
+{
+    cw->pred_cpu = raw_smp_processor_id();
+    cw->queued_at = ktime_get_ns();
+    if (cw->stats)
+        atomic64_inc(&cw->stats->queued);
+    if (client_work_batch_add(cw))
+        return;
+
+    cw->placed_ns = client_work_cost_ns(cw);
+    cw->placed_cpu = placement_select_cpu(cw->req, cw->placed_ns);
+    exec_queue_work(q, cw->placed_cpu, cw);
+}
+
+void client_request_queue(struct client_request *req, struct exec_queue *q, struct client_work *cw)
+{
+    atomic_inc(&req->pending);
+    if (req->run_to_completion)
     {
-        pr_err("%s: Failed to w_net: %d\n", THIS_MODULE->name, res);
+        if (cw->stats)
+            atomic64_inc(&cw->stats->fused);
+        client_work_run(cw);
         return;
     }
 
-    // pr_info("%s: PID of w_net: %d\n", THIS_MODULE->name, get_current()->pid);
-    // pr_info("%s: network done\n", THIS_MODULE->name);
-    for (int i = 0; i < c_task->total_next_workqueue; i++)
+    client_work_queue(q, cw);
+}
+
+struct client_work *client_work_done(struct client_work *c_task, bool ok)
+{
+    struct client_request *req = c_task->req;
+    struct client_work *fused = NULL;
+    u64 threshold = READ_ONCE(fuse_threshold_ns);
+
+    for (int i = 0; ok && i < c_task->total_next_workqueue; i++)
     {
         struct next_workqueue *next_wq = &c_task->next_works[i];
-        INIT_WORK(&next_wq->cw->work, next_wq->func);
-        queue_work(next_wq->wq, &next_wq->cw->work);
+        struct client_work *next = next_wq->cw;
+        // join: only the last predecessor to finish queues it
+        if (!atomic_dec_and_test(&next->pending_preds))
+            continue;
+        // accounted before queueing, pending can't reach 0 while a
+        // successor is about to run
+        if (req)
+            atomic_inc(&req->pending);
+
+        // one cheap successor (any in run-to-completion) continues on
+        // this worker, the others are queued first so parallel branches
+        // start right away
+        if (!fused && ((req && req->run_to_completion) || (threshold && client_work_cost_ns(next) <= threshold)))
+        {
+            fused = next;
+            if (next->stats)
+                atomic64_inc(&next->stats->fused);
+            continue;
+        }
+
+        client_work_queue(next_wq->q, next);
+    }
+
+    if (req && atomic_dec_and_test(&req->pending))
+        client_request_complete(req);
+    return fused;
+}
+
+/*
+ * Op vtable, init and fini are optional
+ */
+struct task_op
+{
+    const char *name;
+    int (*init)(struct task *t);
+    int (*run)(struct task *t);
+    void (*fini)(struct task *t);
+};
+
+static int task_cpu_init(struct task *t) { return op_cpu_matrix_multiplication_init(&t->args.cpu_args); }
+
+static int task_cpu_run(struct task *t)
+{
+    op_cpu_matrix_multiplication(&t->args.cpu_args);
+    return 0;
+}
+
+static void task_cpu_fini(struct task *t) { op_cpu_matrix_multiplication_free(&t->args.cpu_args); }
+
+static int task_disk_run(struct task *t) { return op_disk_write(&t->args.disk_args); }
+
+static int task_net_run(struct task *t) { return op_network_send(&t->args.net_args); }
+
+static int task_conn_net_run(struct task *t) { return op_network_conn_send(&t->args.net_args); }
+
+static void task_conn_net_fini(struct task *t)
+{
+    // last user of the shared payload frees it
+    page_buf_put(t->args.net_args.args.conn_send.pages);
+    t->args.net_args.args.conn_send.pages = NULL;
+}
+
+static const struct task_op task_ops[] = {
+    [TASK_CPU] = {.name = "cpu", .init = task_cpu_init, .run = task_cpu_run, .fini = task_cpu_fini},
+    [TASK_DISK] = {.name = "disk", .run = task_disk_run},
+    [TASK_NET] = {.name = "ack", .run = task_net_run},
+    [TASK_NET_CONN] = {.name = "notify", .run = task_conn_net_run, .fini = task_conn_net_fini},
+};
+
+struct task_op_stats
+{
+    atomic64_t runs;
+    atomic64_t errors;
+    atomic64_t op_ns;   // init + run + fini
+    atomic64_t exec_ns; // whole client_work_exec, the difference is the executor overhead
+    atomic64_t max_op_ns;
+};
+
+static struct task_op_stats task_op_stats[ARRAY_SIZE(task_ops)];
+
+static void task_op_account(struct task_op_stats *st, bool ok, u64 op_ns, u64 exec_ns)
+{
+    s64 max = atomic64_read(&st->max_op_ns);
+
+    atomic64_inc(&st->runs);
+    if (!ok)
+        atomic64_inc(&st->errors);
+    atomic64_add(op_ns, &st->op_ns);
+    atomic64_add(exec_ns, &st->exec_ns);
+    while (op_ns > max)
+    {
+        s64 old = atomic64_cmpxchg(&st->max_op_ns, max, op_ns);
+        if (old == max)
+            break;
+        max = old;
+    }
+}
+
+static u64 task_op_cost_ns(enum task_type type)
+{
+    struct task_op_stats *st = &task_op_stats[type];
+    s64 runs = atomic64_read(&st->runs);
+
+    // never measured, assume it is expensive
+    return runs ? div64_u64(atomic64_read(&st->op_ns), runs) : U64_MAX;
+}
+
+/*
+ * Checks done before running c_task
+ * @return false when c_task must be skipped, its request was cancelled.
+ */
+static bool client_work_start(struct client_work *c_task, u64 now)
+{
+    u64 deadline = client_work_deadline(c_task);
+
+    if (client_work_cancelled(c_task, now))
+    {
+        if (c_task->stats)
+            atomic64_inc(&c_task->stats->cancelled);
+        return false;
     }
+
+    if (deadline && now > deadline && c_task->stats)
+        atomic64_inc(&c_task->stats->deadline_missed);
+    return true;
 }
 
-void w_conn_net(struct work_struct *work)
+/*
+ * Account the run of c_task, which returned res after op_ns, and release its successors
+ * @start: when the run started, for the executor overhead
+ * @return the successor to run inline, see client_work_done().
+ */
+static struct client_work *client_work_finish(struct client_work *c_task, int res, u64 op_ns, u64 start)
 {
-    struct client_work *c_task = container_of(work, struct client_work, work);
-    // TODO: make generic call function here
-    int res = op_network_conn_send(&c_task->t.args.net_args);
+    enum task_type type = c_task->type;
+    struct predictor *pred = c_task->pred;
+    u64 stage_timeout = (u64)READ_ONCE(stage_timeout_us) * NSEC_PER_USEC;
+    bool timed_out = false;
+    struct client_work *next;
+
     if (unlikely(res < 0))
+        pr_err("%s: Failed to run %s task: %d\n", THIS_MODULE->name, task_ops[type].name, res);
+
+    if ((res < 0 && ksocket_timed_out(res)) || (stage_timeout && op_ns > stage_timeout))
     {
-        pr_err("%s: Failed to w_conn_net: %d\n", THIS_MODULE->name, res);
-        return;
+        if (c_task->stats)
+            atomic64_inc(&c_task->stats->timed_out);
+        if (c_task->req)
+            client_request_cancel(c_task->req);
+        timed_out = true;
     }
 
-    // pr_info("%s: PID of w_conn_net: %d\n", THIS_MODULE->name, get_current()->pid);
-    // pr_info("%s: network done\n", THIS_MODULE->name);
-    for (int i = 0; i < c_task->total_next_workqueue; i++)
+    // c_task may be freed by now if the request completed
+    next = client_work_done(c_task, res >= 0 && !timed_out);
+    task_op_account(&task_op_stats[type], res >= 0, op_ns, ktime_get_ns() - start);
+    // failed runs stop early, they would drag the model down
+    if (pred && res >= 0)
+        predictor_update(pred, op_ns);
+    return next;
+}
+
+/*
+ * Run leader and the members of its batch in one pass. They belong to the same stage so the op is set up once with
+ * the arguments of the leader and run for each, the members are released as soon as they ran and the leader last.
+ */
+static void client_work_run_batch(struct client_work *leader)
+{
+    const struct task_op *op = &task_ops[leader->type];
+    struct client_work *cw, *tmp, *next;
+    LIST_HEAD(members);
+    LIST_HEAD(ready);
+    u64 start, run_start, setup_ns;
+    bool leader_runs;
+    int nr, setup_res = 0, res = 0;
+
+    nr = client_work_batch_close(leader, &members);
+    if (leader->stats)
+        atomic64_inc(&leader->stats->batches);
+
+    start = ktime_get_ns();
+    // a cancelled leader still holds the arguments of the batch
+    leader_runs = client_work_start(leader, start);
+    if (op->init)
+        setup_res = op->init(&leader->t);
+    setup_ns = ktime_get_ns() - start;
+
+    list_for_each_entry_safe(cw, tmp, &members, ws_node)
     {
-        struct next_workqueue *next_wq = &c_task->next_works[i];
-        INIT_WORK(&next_wq->cw->work, next_wq->func);
-        queue_work(next_wq->wq, &next_wq->cw->work);
+        run_start = ktime_get_ns();
+        list_del(&cw->ws_node);
+        placement_account_exec(cw->pred_cpu, cw->placed_cpu, cw->placed_ns);
+        if (cw->stats)
+        {
+            atomic64_inc(&cw->stats->batched);
+            atomic64_add(run_start - cw->queued_at, &cw->stats->wait_ns);
+        }
+        if (!client_work_start(cw, run_start))
+        {
+            client_work_done(cw, false);
+            continue;
+        }
+
+        res = likely(setup_res >= 0) ? op->run(&leader->t) : setup_res;
+        // the setup is shared by the whole batch
+        next = client_work_finish(cw, res, ktime_get_ns() - run_start + div_u64(setup_ns, nr), run_start);
+        if (next)
+            list_add_tail(&next->ws_node, &ready);
+    }
+
+    run_start = ktime_get_ns();
+    res = setup_res;
+    if (leader_runs && likely(setup_res >= 0))
+        res = op->run(&leader->t);
+    if (likely(setup_res >= 0) && op->fini)
+        op->fini(&leader->t);
+    if (leader_runs)
+        next = client_work_finish(leader, res, ktime_get_ns() - run_start + div_u64(setup_ns, nr), run_start);
+    else
+        next = client_work_done(leader, false);
+    if (next)
+        list_add_tail(&next->ws_node, &ready);
+
+    // fused successors, run once the whole batch was released
+    list_for_each_entry_safe(cw, tmp, &ready, ws_node)
+    {
+        list_del(&cw->ws_node);
+        client_work_run(cw);
     }
 }
 
-void w_disk(struct work_struct *work)
+/*
+ * Run c_task then the successors handed back by client_work_done
+ */
+static void client_work_run(struct client_work *c_task)
 {
-    struct client_work *c_task = container_of(work, struct client_work, work);
-    // TODO: make generic call function here
-    int ret = op_disk_write(&c_task->t.args.disk_args);
-    if (unlikely(ret < 0))
+    if (c_task->batch_nr)
     {
-        pr_err("%s: Failed to w_disk: %d\n", THIS_MODULE->name, ret);
+        client_work_run_batch(c_task);
         return;
     }
 
-    // pr_info("%s: PID of w_disk: %d\n", THIS_MODULE->name, get_current()->pid);
-    // pr_info("%s: Disk operation finished, read: %d\n", THIS_MODULE->name, ret);
-    for (int i = 0; i < c_task->total_next_workqueue; i++)
+    while (c_task)
     {
-        struct next_workqueue *next_wq = &c_task->next_works[i];
-        INIT_WORK(&next_wq->cw->work, next_wq->func);
-        queue_work(next_wq->wq, &next_wq->cw->work);
+        const struct task_op *op = &task_ops[c_task->type];
+        u64 start = ktime_get_ns();
+        int res = 0;
+
+        // the successors are dropped with it, the request completes once
+        // the branches already running return
+        if (!client_work_start(c_task, start))
+        {
+            c_task = client_work_done(c_task, false);
+            continue;
+        }
+
+        if (op->init)
+            res = op->init(&c_task->t);
+        if (likely(res >= 0))
+        {
+            res = op->run(&c_task->t);
+            if (op->fini)
+                op->fini(&c_task->t);
+        }
+
+        c_task = client_work_finish(c_task, res, ktime_get_ns() - start, start);
+    }
+}
+
+void client_work_exec(struct client_work *c_task)
+{
+    placement_account_exec(c_task->pred_cpu, c_task->placed_cpu, c_task->placed_ns);
+    if (c_task->stats && c_task->queued_at)
+        atomic64_add(ktime_get_ns() - c_task->queued_at, &c_task->stats->wait_ns);
+
+    client_work_run(c_task);
+}
+
+// the names are the ops of the DAG spec (see dag.c)
+const char *task_op_name(enum task_type type) { return task_ops[type].name; }
+
+int task_op_parse(const char *name)
+{
+    for (int i = 0; i < ARRAY_SIZE(task_ops); i++)
+        if (strcmp(task_ops[i].name, name) == 0)
+            return i;
+    return -EINVAL;
+}
+
+/*
+ * Upper bound of the bucket holding the p-th percentile
+ */
+static u64 req_lat_percentile(struct req_lat_stats *st, s64 completed, int p)
+{
+    s64 seen = 0;
+
+    for (int b = 0; b < REQ_LAT_BUCKETS; b++)
+    {
+        seen += atomic64_read(&st->hist[b]);
+        if (seen * 100 >= completed * p)
+            return 1ULL << b;
+    }
+    return U64_MAX;
+}
+
+static int req_stats_show(struct seq_file *m, void *v)
+{
+    static const char *const names[] = {[EXEC_STAGED] = "staged", [EXEC_RUN_TO_COMPLETION] = "run_to_completion"};
+
+    seq_printf(m, "exec_mode=%s\n", names[READ_ONCE(exec_mode) == EXEC_RUN_TO_COMPLETION]);
+    for (int i = 0; i < EXEC_MODE_COUNT; i++)
+    {
+        struct req_lat_stats *st = &req_lat_stats[i];
+        s64 completed = atomic64_read(&st->completed);
+
+        s64 cancelled = atomic64_read(&st->cancelled);
+
+        if (!completed && !cancelled)
+            continue;
+        seq_printf(m,
+                   "%s completed=%lld cancelled=%lld deadline_missed=%lld latency_ns_avg=%lld p50<=%llu p99<=%llu\n",
+                   names[i], completed, cancelled, atomic64_read(&st->deadline_missed),
+                   completed ? div64_s64(atomic64_read(&st->total_ns), completed) : 0,
+                   req_lat_percentile(st, completed, 50), req_lat_percentile(st, completed, 99));
     }
+    return 0;
 }
+DEFINE_SHOW_ATTRIBUTE(req_stats);
 
-void free_client_work_list(void)
+static int task_stats_show(struct seq_file *m, void *v)
 {
-    struct client_work *cw, *tmp;
-    int counter = 0;
-    list_for_each_entry_safe(cw, tmp, &lclients_works, list)
+    for (int i = 0; i < ARRAY_SIZE(task_ops); i++)
     {
-        list_del(&cw->list);
-        kfree(cw);
-        counter++;
+        struct task_op_stats *st = &task_op_stats[i];
+        s64 runs = atomic64_read(&st->runs);
+        s64 op_ns = atomic64_read(&st->op_ns);
+        s64 exec_ns = atomic64_read(&st->exec_ns);
+
+        seq_printf(m, "%s runs=%lld errors=%lld op_ns_avg=%lld op_ns_max=%lld overhead_ns_avg=%lld\n", task_ops[i].name,
+                   runs, atomic64_read(&st->errors), runs ? div64_s64(op_ns, runs) : 0, atomic64_read(&st->max_op_ns),
+                   runs ? div64_s64(exec_ns - op_ns, runs) : 0);
     }
-    pr_info("%s: Freed %d client works\n", THIS_MODULE->name, counter);
-}
\ No newline at end of file
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(task_stats);
+
+void task_stats_init(void)
+{
+    kserver_stats_create_file("ops", &task_stats_fops);
+    kserver_stats_create_file("requests", &req_stats_fops);
+}
@@ -2,12 +2,16 @@
 #include "ksocket_handler.h"
 #include "operations.h"
 #include <asm/atomic.h>
+#include <linux/kthread.h>
 #include <linux/list.h>
+#include <linux/llist.h>
 #include <linux/slab.h>
 #include <linux/spinlock.h>
+#include <linux/wait.h>
 #include <linux/workqueue.h>
 
-#define MAX_PARALLEL_TASKS 10
+// the MOM cpu stage fans out to every subscriber (MAX_LISTEN_SOCKETS in mom.c) and to the ack
+#define MAX_PARALLEL_TASKS 11
 struct task
 {
     union
@@ -24,33 +28,174 @@ enum task_type
 {
     TASK_CPU,
     TASK_DISK,
-    TASK_NET,
+    TASK_NET,      // send to the client of the request
+    TASK_NET_CONN, // connect and send to a subscriber
+};
+
+struct _client;
+struct dag_instance;
+struct predictor;
+
+/*
+ * One request going through a task graph, shared by all its client_work
+ */
+struct client_request
+{
+    // client_work queued and not finished yet, the request is complete
+    // when it drops to 0 (see client_work_done)
+    atomic_t pending;
+    struct _client *cl;         // Optional, client which sent the request
+    struct dag_instance *inst; // client_work of the request, released with it
+    u64 start_ns;              // parsed, for the end-to-end latency
+    u64 deadline_ns;           // 0: none (see request_deadline_us)
+    u64 timeout_ns;            // 0: none, past it the request is cancelled (see request_timeout_us)
+    // set once, the client_work not started yet are skipped (see client_work_cancelled)
+    atomic_t cancelled;
+    bool run_to_completion; // exec_mode when the request was parsed
+};
+
+/*
+ * Hops into a stage, shared by all the instances of a template
+ */
+struct stage_stats
+{
+    atomic64_t queued;
+    atomic64_t fused;   // run inline on the worker of the predecessor
+    atomic64_t wait_ns; // queue_work to execution, of the queued hops
+    atomic64_t deadline_missed; // started after the deadline of the request
+    atomic64_t timed_out;       // ran longer than stage_timeout_us or its socket timed out
+    atomic64_t cancelled;       // skipped, the request was cancelled before it started
+    atomic64_t batches;         // batches led (see batch_max_size)
+    atomic64_t batched;         // ran in the batch of another client_work
 };
 
 struct client_work;
+
+/*
+ * Batching of the client_work queued on a stage, shared by all the instances of a template
+ */
+struct stage_batch
+{
+    spinlock_t lock;
+    // leader of the batch still accepting members, NULL when none
+    struct client_work *open;
+    wait_queue_head_t full; // woken when the open batch is full
+};
+
+struct exec_queue;
+
 struct next_workqueue
 {
-    struct workqueue_struct *wq;
+    struct exec_queue *q;
     struct client_work *cw;
-    void (*func)(struct work_struct *);
 };
 
 struct client_work
 {
-    struct list_head list;
-    struct work_struct work;
+    // queued through the executor backend of its stage (see executor.h)
+    union
+    {
+        struct work_struct work;
+        struct kthread_work kwork;
+        struct llist_node rq_node;
+        struct list_head ws_node;
+    };
+    struct exec_queue *exec_q;
+    u64 exec_queued_at;
+    enum task_type type; // op run by client_work_exec
     struct task t;
+    struct client_request *req;
+    // predecessors not finished yet, the last one queues this client_work
+    atomic_t pending_preds;
+    struct stage_stats *stats; // Optional
+    struct predictor *pred;    // Optional, runtime model of the op (see predictor.h)
+    struct stage_batch *batch; // Optional, set when the op of the stage can run batched
+    // members (linked by ws_node) of the batch this client_work leads, batch_nr counts the leader, 0 when not
+    // leading any
+    struct list_head batch_members;
+    int batch_nr;
+    u64 queued_at;
+    int pred_cpu;   // CPU that queued it
+    int placed_cpu; // see placement_select_cpu
+    u64 placed_ns;  // predicted cost accounted on placed_cpu
     size_t total_next_workqueue;
     // TODO: Actually, here we should use a struct list_head, but for simplicity sake now it is more duable to use an
     // array
     struct next_workqueue next_works[MAX_PARALLEL_TASKS];
 };
 
-extern spinlock_t lclients_works_lock;
-extern struct list_head lclients_works;
-void free_client_work_list(void);
+/*
+ * client_request_alloc - Allocate a request admitted for cl (see admission.h)
+ * @return the request or NULL on allocation failure.
+ */
+struct client_request *client_request_alloc(struct _client *cl);
+
+/*
+ * client_request_complete - Release the request, called once nothing is pending anymore or directly when the
+ * request could not be started.
+ */
+void client_request_complete(struct client_request *req);
+
+/*
+ * client_request_queue - Queue the first client_work of a request, or run the request right away in
+ * run-to-completion mode
+ */
+void client_request_queue(struct client_request *req, struct exec_queue *q, struct client_work *cw);
+
+/*
+ * client_request_cancel - Cancel req, its client_work not started yet are skipped and it completes once the
+ * running ones return
+ * @return true for the call that cancelled it, false if it already was.
+ */
+bool client_request_cancel(struct client_request *req);
+
+/*
+ * client_work_done - To call once the op of c_task ran, queues the successors whose predecessors are all done when
+ * ok is set and completes the request once nothing is pending anymore.
+ * @return a successor to run inline on the current worker (see fuse_threshold_ns) or NULL.
+ */
+struct client_work *client_work_done(struct client_work *c_task, bool ok);
+
+/*
+ * client_work_deadline - Deadline of the request of cw in ns (ktime_get_ns), 0 when it has none
+ */
+u64 client_work_deadline(const struct client_work *cw);
+
+/*
+ * client_work_cost_ns - Predicted runtime of the op of cw, from its predictor or else the average of its op type
+ * @return the cost in ns, U64_MAX when the op never ran.
+ */
+u64 client_work_cost_ns(const struct client_work *cw);
+
+/*
+ * client_work_urgent - Whether cw, once its predicted cost is run, ends close enough to its deadline
+ * (deadline_urgent_us) to jump the queue
+ */
+bool client_work_urgent(const struct client_work *cw);
+
+/*
+ * stage_batch_init - Initialize the batching state of a stage, no batch is open
+ */
+void stage_batch_init(struct stage_batch *b);
+
+/*
+ * client_work_exec - Called by the executor backend for every queued client_work, runs the op of its type
+ * (init/run/fini) with timing and queues the successors
+ */
+void client_work_exec(struct client_work *c_task);
+
+/*
+ * task_op_name - Name of the op run for type
+ */
+const char *task_op_name(enum task_type type);
+
+/*
+ * task_op_parse - Type of the op called name in a DAG spec
+ * @return the task_type or -EINVAL
+ */
+int task_op_parse(const char *name);
 
-void w_cpu(struct work_struct *work);
-void w_net(struct work_struct *work);
-void w_conn_net(struct work_struct *work);
-void w_disk(struct work_struct *work);
+/*
+ * task_stats_init - Register the per op counters and the request latencies in debugfs
+ */
+void task_stats_init(void);
@@ -0,0 +1,346 @@
+#include <linux/cpumask.h>
+#include <linux/fs.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/version.h>
+
+#include "stats.h"
+#include "wq_attrs.h"
+
+#define WQ_ATTRS_MAX_WQS 64
+#define WQ_ATTRS_CPULIST_LEN 64
+#define WQ_ATTRS_SYSFS_DIR "/sys/devices/virtual/workqueue"
+
+struct wq_attrs_opts
+{
+    unsigned int flags;
+    int max_active;                      // 0: default
+    char cpumask[WQ_ATTRS_CPULIST_LEN]; // cpulist, empty: every CPU
+    char affinity[16];                   // empty: default scope
+};
+
+struct kserver_wq
+{
+    char name[WQ_ATTRS_NAME_LEN];
+    char attrs_name[WQ_ATTRS_NAME_LEN]; // entry of wq_attrs it follows
+    struct workqueue_struct *wq;
+    unsigned int extra_flags; // given by the caller, not by wq_attrs
+    struct wq_attrs_opts opts;
+};
+
+static struct kserver_wq kserver_wqs[WQ_ATTRS_MAX_WQS];
+static int nr_kserver_wqs = 0;
+static DEFINE_MUTEX(kserver_wqs_lock);
+
+static const char *wq_affinity_scopes[] = {"default", "cpu", "smt", "cache", "numa", "system"};
+
+static int wq_attrs_set(const char *val, const struct kernel_param *kp);
+
+static char *wq_attrs = "";
+static const struct kernel_param_ops wq_attrs_ops = {
+    .set = wq_attrs_set,
+    .get = param_get_charp,
+    .free = param_free_charp,
+};
+module_param_cb(wq_attrs, &wq_attrs_ops, &wq_attrs, 0644);
+MODULE_PARM_DESC(wq_attrs, "Per workqueue attributes, e.g. 'mom_second_step_cpu:unbound,cpu_intensive,max_active=4,"
+                           "cpumask=0-3+8-11,affinity=cache;kserver_clients_read:highpri' (see wq_attrs.h)");
+
+static int wq_attrs_parse_opt(struct wq_attrs_opts *opts, char *opt)
+{
+    char *value = strchr(opt, '=');
+
+    if (value)
+        *value++ = '\0';
+
+    if (!value && strcmp(opt, "bound") == 0)
+        opts->flags &= ~WQ_UNBOUND;
+    else if (!value && strcmp(opt, "unbound") == 0)
+        opts->flags |= WQ_UNBOUND;
+    else if (!value && strcmp(opt, "highpri") == 0)
+        opts->flags |= WQ_HIGHPRI;
+    else if (!value && strcmp(opt, "cpu_intensive") == 0)
+        opts->flags |= WQ_CPU_INTENSIVE;
+    else if (!value && strcmp(opt, "sysfs") == 0)
+        opts->flags |= WQ_SYSFS;
+    else if (value && strcmp(opt, "max_active") == 0)
+    {
+        if (kstrtoint(value, 10, &opts->max_active) < 0 || opts->max_active < 1 || opts->max_active > WQ_MAX_ACTIVE)
+            return -EINVAL;
+    }
+    else if (value && strcmp(opt, "cpumask") == 0)
+    {
+        cpumask_var_t mask;
+        int ret;
+
+        // ',' separates the options, '+' the ranges of the cpulist
+        strreplace(value, '+', ',');
+        if (strscpy(opts->cpumask, value, sizeof(opts->cpumask)) < 0)
+            return -EINVAL;
+        if (!alloc_cpumask_var(&mask, GFP_KERNEL))
+            return -ENOMEM;
+        ret = cpulist_parse(opts->cpumask, mask);
+        if (ret == 0 && !cpumask_intersects(mask, cpu_online_mask))
+            ret = -EINVAL;
+        free_cpumask_var(mask);
+        return ret;
+    }
+    else if (value && strcmp(opt, "affinity") == 0)
+    {
+        if (match_string(wq_affinity_scopes, ARRAY_SIZE(wq_affinity_scopes), value) < 0)
+            return -EINVAL;
+        strscpy(opts->affinity, value, sizeof(opts->affinity));
+    }
+    else
+        return -EINVAL;
+
+    return 0;
+}
+
+/*
+ * Fill opts with the entry of name in spec, every entry is checked when name is NULL
+ */
+static int wq_attrs_parse(const char *spec, const char *name, struct wq_attrs_opts *opts)
+{
+    struct wq_attrs_opts scratch;
+    char *spec_copy, *ptr, *entry;
+    int ret = 0;
+
+    memset(opts, 0, sizeof(*opts));
+    if (!spec || !*spec)
+        return 0;
+
+    spec_copy = kstrdup(spec, GFP_KERNEL);
+    if (unlikely(!spec_copy))
+        return -ENOMEM;
+
+    ptr = spec_copy;
+    while (ret == 0 && (entry = strsep(&ptr, ";")))
+    {
+        char *wq_name = strim(strsep(&entry, ":"));
+        struct wq_attrs_opts *target = opts;
+        char *opt;
+
+        if (!*wq_name)
+            continue;
+        if (!entry)
+        {
+            pr_err("%s: wq_attrs: missing ':' after %s\n", THIS_MODULE->name, wq_name);
+            ret = -EINVAL;
+            break;
+        }
+        if (name && strcmp(wq_name, name) != 0)
+            continue;
+        if (!name)
+        {
+            memset(&scratch, 0, sizeof(scratch));
+            target = &scratch;
+        }
+
+        while ((opt = strsep(&entry, ",")))
+        {
+            opt = strim(opt);
+            if (!*opt)
+                continue;
+            ret = wq_attrs_parse_opt(target, opt);
+            if (ret < 0)
+            {
+                pr_err("%s: wq_attrs: invalid option %s for %s\n", THIS_MODULE->name, opt, wq_name);
+                break;
+            }
+        }
+    }
+
+    kfree(spec_copy);
+    return ret;
+}
+
+/*
+ * Write an attribute of a WQ_SYSFS workqueue, the only way to change the
+ * cpumask and affinity scope of an unbound workqueue from a module
+ */
+static int wq_attrs_sysfs_write(const char *name, const char *attr, const char *val)
+{
+    char path[96];
+    loff_t pos = 0;
+    struct file *file;
+    ssize_t ret;
+
+    snprintf(path, sizeof(path), WQ_ATTRS_SYSFS_DIR "/%s/%s", name, attr);
+    file = filp_open(path, O_WRONLY, 0);
+    if (IS_ERR(file))
+        return PTR_ERR(file);
+
+    ret = kernel_write(file, val, strlen(val), &pos);
+    filp_close(file, NULL);
+    return ret < 0 ? ret : 0;
+}
+
+/*
+ * Apply what can change on a live workqueue, called with kserver_wqs_lock
+ */
+static void wq_attrs_apply(struct kserver_wq *w, const struct wq_attrs_opts *opts)
+{
+    int ret;
+
+    if ((opts->flags | w->extra_flags) != w->opts.flags)
+        pr_warn("%s: wq_attrs: flags of %s only change on the next load\n", THIS_MODULE->name, w->name);
+
+    workqueue_set_max_active(w->wq, opts->max_active ?: WQ_DFL_ACTIVE);
+    w->opts.max_active = opts->max_active;
+
+    if (!(w->opts.flags & WQ_UNBOUND))
+    {
+        if (opts->cpumask[0] || opts->affinity[0])
+            pr_warn("%s: wq_attrs: cpumask and affinity ignored on bound %s\n", THIS_MODULE->name, w->name);
+        return;
+    }
+
+    if (strcmp(opts->cpumask, w->opts.cpumask) != 0)
+    {
+        cpumask_var_t mask;
+        char buf[256];
+
+        if (!alloc_cpumask_var(&mask, GFP_KERNEL))
+            return;
+        if (opts->cpumask[0])
+            cpulist_parse(opts->cpumask, mask);
+        else
+            cpumask_copy(mask, cpu_possible_mask);
+        // the sysfs file takes a hex mask
+        snprintf(buf, sizeof(buf), "%*pb\n", cpumask_pr_args(mask));
+        free_cpumask_var(mask);
+
+        ret = wq_attrs_sysfs_write(w->name, "cpumask", buf);
+        if (unlikely(ret < 0))
+            pr_err("%s: wq_attrs: failed to set cpumask of %s: %d\n", THIS_MODULE->name, w->name, ret);
+        else
+            strscpy(w->opts.cpumask, opts->cpumask, sizeof(w->opts.cpumask));
+    }
+
+    if (strcmp(opts->affinity, w->opts.affinity) != 0)
+    {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+        ret = wq_attrs_sysfs_write(w->name, "affinity_scope", opts->affinity[0] ? opts->affinity : "default");
+        if (unlikely(ret < 0))
+            pr_err("%s: wq_attrs: failed to set affinity of %s: %d\n", THIS_MODULE->name, w->name, ret);
+        else
+            strscpy(w->opts.affinity, opts->affinity, sizeof(w->opts.affinity));
+#else
+        pr_warn("%s: wq_attrs: affinity scopes need Linux 6.5, ignored for %s\n", THIS_MODULE->name, w->name);
+#endif
+    }
+}
+
+static int wq_attrs_set(const char *val, const struct kernel_param *kp)
+{
+    struct wq_attrs_opts opts;
+    int ret = wq_attrs_parse(val, NULL, &opts);
+    if (ret < 0)
+        return ret;
+
+    ret = param_set_charp(val, kp);
+    if (ret < 0)
+        return ret;
+
+    mutex_lock(&kserver_wqs_lock);
+    for (int i = 0; i < nr_kserver_wqs; i++)
+    {
+        if (wq_attrs_parse(val, kserver_wqs[i].attrs_name, &opts) == 0)
+            wq_attrs_apply(&kserver_wqs[i], &opts);
+    }
+    mutex_unlock(&kserver_wqs_lock);
+    return 0;
+}
+
+struct workqueue_struct *kserver_alloc_workqueue(const char *name, unsigned int extra_flags)
+{
+    return kserver_alloc_workqueue_as(name, name, extra_flags);
+}
+
+struct workqueue_struct *kserver_alloc_workqueue_as(const char *name, const char *attrs_name,
+                                                    unsigned int extra_flags)
+{
+    struct wq_attrs_opts opts;
+    struct workqueue_struct *wq;
+    struct kserver_wq *w;
+    unsigned int flags;
+    int ret;
+
+    kernel_param_lock(THIS_MODULE);
+    ret = wq_attrs_parse(wq_attrs, attrs_name, &opts);
+    kernel_param_unlock(THIS_MODULE);
+    if (unlikely(ret < 0))
+        return NULL;
+
+    opts.flags |= extra_flags;
+    // unbound workqueues get sysfs so cpumask and affinity can be tuned
+    flags = opts.flags | (opts.flags & WQ_UNBOUND ? WQ_SYSFS : 0);
+
+    mutex_lock(&kserver_wqs_lock);
+    if (unlikely(nr_kserver_wqs == WQ_ATTRS_MAX_WQS))
+    {
+        mutex_unlock(&kserver_wqs_lock);
+        pr_err("%s: too many workqueues (max %d)\n", THIS_MODULE->name, WQ_ATTRS_MAX_WQS);
+        return NULL;
+    }
+
+    wq = alloc_workqueue("%s", flags, opts.max_active, name);
+    if (unlikely(!wq))
+    {
+        mutex_unlock(&kserver_wqs_lock);
+        pr_err("%s: Failed to create workqueue %s\n", THIS_MODULE->name, name);
+        return NULL;
+    }
+
+    w = &kserver_wqs[nr_kserver_wqs++];
+    strscpy(w->name, name, WQ_ATTRS_NAME_LEN);
+    strscpy(w->attrs_name, attrs_name, WQ_ATTRS_NAME_LEN);
+    w->wq = wq;
+    w->extra_flags = extra_flags;
+    w->opts = (struct wq_attrs_opts){.flags = opts.flags, .max_active = opts.max_active};
+    if (opts.cpumask[0] || opts.affinity[0])
+        wq_attrs_apply(w, &opts);
+    mutex_unlock(&kserver_wqs_lock);
+
+    return wq;
+}
+
+void kserver_destroy_workqueue(struct workqueue_struct *wq)
+{
+    mutex_lock(&kserver_wqs_lock);
+    for (int i = 0; i < nr_kserver_wqs; i++)
+    {
+        if (kserver_wqs[i].wq == wq)
+        {
+            kserver_wqs[i] = kserver_wqs[--nr_kserver_wqs];
+            break;
+        }
+    }
+    mutex_unlock(&kserver_wqs_lock);
+
+    // drains the pending work first
+    destroy_workqueue(wq);
+}
+
+static int wq_attrs_stats_show(struct seq_file *m, void *v)
+{
+    mutex_lock(&kserver_wqs_lock);
+    for (int i = 0; i < nr_kserver_wqs; i++)
+    {
+        const struct kserver_wq *w = &kserver_wqs[i];
+
+        seq_printf(m, "%s %s%s%s max_active=%d cpumask=%s affinity=%s\n", w->name,
+                   w->opts.flags & WQ_UNBOUND ? "unbound" : "bound", w->opts.flags & WQ_HIGHPRI ? ",highpri" : "",
+                   w->opts.flags & WQ_CPU_INTENSIVE ? ",cpu_intensive" : "", w->opts.max_active ?: WQ_DFL_ACTIVE,
+                   w->opts.cpumask[0] ? w->opts.cpumask : "all", w->opts.affinity[0] ? w->opts.affinity : "default");
+    }
+    mutex_unlock(&kserver_wqs_lock);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(wq_attrs_stats);
+
+void wq_attrs_stats_init(void) { kserver_stats_create_file("workqueues", &wq_attrs_stats_fops); }
@@ -0,0 +1,32 @@
+#pragma once
+#include <linux/workqueue.h>
+
+#define WQ_ATTRS_NAME_LEN 32
+
+/*
+ * kserver_alloc_workqueue - Create a workqueue with the attributes given for name in the wq_attrs module
+ * parameter, format: "NAME:OPT[,OPT...][;NAME:...]" where OPT is one of
+ *   bound, unbound, highpri, cpu_intensive, sysfs, max_active=N, cpumask=CPULIST,
+ *   affinity=default|cpu|smt|cache|numa|system
+ * e.g. "mom_second_step_cpu:unbound,cpu_intensive,cpumask=0-3,affinity=cache;mom_third_step_net_ack:highpri"
+ * cpumask and affinity need an unbound workqueue, unbound workqueues are always registered in sysfs. Writing
+ * wq_attrs at runtime applies max_active, cpumask and affinity to the existing workqueues, the flags only
+ * change on the next load.
+ * @extra_flags: WQ_* flags added to the configured ones
+ * @return the workqueue or NULL on failure.
+ */
+struct workqueue_struct *kserver_alloc_workqueue(const char *name, unsigned int extra_flags);
+
+/*
+ * kserver_alloc_workqueue_as - Same as kserver_alloc_workqueue() but the workqueue follows the wq_attrs entry of
+ * attrs_name, at creation and on runtime writes, e.g. a sibling sharing the attributes of its base workqueue
+ */
+struct workqueue_struct *kserver_alloc_workqueue_as(const char *name, const char *attrs_name,
+                                                    unsigned int extra_flags);
+
+/*
+ * kserver_destroy_workqueue - Drain and destroy a workqueue created by kserver_alloc_workqueue()
+ */
+void kserver_destroy_workqueue(struct workqueue_struct *wq);
+
+void wq_attrs_stats_init(void);
@@ -4,6 +4,7 @@
 #include <netdb.h>
 #include <netinet/in.h>
 #include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -20,6 +21,9 @@
 #define CHECK_END_FLAG(buf, len)                                                                                       \
     (len == 6 && (buf[0] == END_FLAG[0]) && (buf[1] == END_FLAG[1]) && (buf[2] == END_FLAG[2]) &&                      \
      (buf[3] == END_FLAG[3]) && (buf[4] == END_FLAG[4]) && (buf[5] == END_FLAG[5]))
+// sent by kserver instead of END_FLAG when admission control rejects the request
+#define REJECT_FLAG "REJECT"
+#define CHECK_REJECT_FLAG(buf, len) (len == 6 && memcmp(buf, REJECT_FLAG, 6) == 0)
 
 // Structure pour les arguments du programme
 struct arguments_t
@@ -38,6 +42,7 @@ struct thread_data
     char *host;
     int port;
     int requests_per_thread;
+    int rejected;
     double avg_response_time;
 };
 
@@ -145,8 +150,13 @@ void *send_request(void *arg)
         return NULL;
     }
 
-    const char *msg = "Hello, server!";
-    ssize_t msg_len = strlen(msg);
+    // kserver frames: 4 bytes length (host order) followed by the payload
+    const char *payload = "Hello, server!";
+    uint32_t payload_len = strlen(payload);
+    char msg[sizeof(payload_len) + 64];
+    memcpy(msg, &payload_len, sizeof(payload_len));
+    memcpy(msg + sizeof(payload_len), payload, payload_len);
+    ssize_t msg_len = sizeof(payload_len) + payload_len;
     for (int i = 0; i < data->requests_per_thread; i++)
     {
         struct timespec start_time, end_time;
@@ -175,6 +185,11 @@ void *send_request(void *arg)
             printf("received END_FLAG\n");
             continue; // Valid response received
         }
+        if (CHECK_REJECT_FLAG(buffer, bytes_received))
+        {
+            data->rejected++;
+            continue; // Server is overloaded, request was not processed
+        }
 
         goto receive; // Continue receiving until we get END_FLAG
     }
@@ -221,6 +236,7 @@ void stress_test(char *host, int port, int num_requests, int num_threads)
         thread_data_array[i].host = host;
         thread_data_array[i].port = port;
         thread_data_array[i].requests_per_thread = requests_per_thread;
+        thread_data_array[i].rejected = 0;
 
         if (pthread_create(&threads[i], NULL, send_request, &thread_data_array[i]) != 0)
             fprintf(stderr, "Failed to create thread %d\n", i);
@@ -230,14 +246,17 @@ void stress_test(char *host, int port, int num_requests, int num_threads)
         pthread_join(threads[i], NULL);
 
     double avg_time_sum = 0.0;
+    int rejected = 0;
     for (int i = 0; i < num_threads; i++)
     {
+        rejected += thread_data_array[i].rejected;
         avg_times[i] = thread_data_array[i].avg_response_time;
         if (avg_times[i] >= 0.0)
             avg_time_sum += avg_times[i];
     }
     double overall_avg_time = avg_time_sum / num_threads;
     printf("Overall average response time: %.4f seconds\n", overall_avg_time);
+    printf("Rejected requests: %d\n", rejected);
 }
 
 int main(int argc, char **argv)